@@ -0,0 +1,159 @@
+/*!
+  \file        alloc_stats.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+Counting of the heap allocations of each frame,
+and measure of the resident memory of the process.
+The global operator new is only replaced when ALLOC_STATS is set to 1,
+with cmake -DCARS_ALLOC_STATS=ON: the other builds count nothing and pay nothing.
+Include it in a single translation unit, as the operators are defined here.
+ */
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+
+#ifndef ALLOC_STATS
+#define ALLOC_STATS 0
+#endif
+
+//! the allocations of all the threads since the start of the program, modulo 2^32
+inline SDL_atomic_t* alloc_counters() {
+  static SDL_atomic_t counters[2]; // allocations, bytes: zero before any constructor
+  return counters;
+}
+
+#if ALLOC_STATS
+#if __cplusplus >= 201103L
+#define ALLOC_STATS_THROW
+#define ALLOC_STATS_NOTHROW noexcept
+#else
+#define ALLOC_STATS_THROW   throw(std::bad_alloc)
+#define ALLOC_STATS_NOTHROW throw()
+#endif
+// not inlined, so that the compiler does not pair malloc() and free() with new and delete
+__attribute__((noinline)) void* alloc_stats_malloc(size_t size) {
+  SDL_AtomicAdd(&alloc_counters()[0], 1);
+  SDL_AtomicAdd(&alloc_counters()[1], (int) size);
+  return malloc(size > 0 ? size : 1);
+}
+__attribute__((noinline)) void alloc_stats_free(void* ptr) { free(ptr); }
+
+void* operator new(size_t size) ALLOC_STATS_THROW {
+  void* ptr = alloc_stats_malloc(size);
+  if (ptr == NULL)
+    throw std::bad_alloc();
+  return ptr;
+}
+void* operator new[](size_t size) ALLOC_STATS_THROW { return operator new(size); }
+void operator delete(void* ptr) ALLOC_STATS_NOTHROW { alloc_stats_free(ptr); }
+void operator delete[](void* ptr) ALLOC_STATS_NOTHROW { alloc_stats_free(ptr); }
+#if __cplusplus >= 201402L // sized deallocation
+void operator delete(void* ptr, std::size_t) ALLOC_STATS_NOTHROW { alloc_stats_free(ptr); }
+void operator delete[](void* ptr, std::size_t) ALLOC_STATS_NOTHROW { alloc_stats_free(ptr); }
+#endif
+#endif // ALLOC_STATS
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! a number of allocations and of allocated bytes
+struct AllocCount {
+  AllocCount() : nallocs(0), bytes(0) {}
+
+  //! the allocations since the start of the program, to subtract from a later one
+  static AllocCount now() {
+    AllocCount c;
+    c.nallocs = SDL_AtomicGet(&alloc_counters()[0]);
+    c.bytes = SDL_AtomicGet(&alloc_counters()[1]);
+    return c;
+  }
+  //! the allocations between \arg start and this count, even if the counters wrapped
+  AllocCount operator - (const AllocCount & start) const {
+    AllocCount c;
+    c.nallocs = nallocs - start.nallocs;
+    c.bytes = bytes - start.bytes;
+    return c;
+  }
+
+  unsigned int nallocs, bytes;
+}; // end struct AllocCount
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*! The statistics of the allocations of a series of frames.
+  Nothing is allocated by add().
+*/
+class AllocMeter {
+public:
+  AllocMeter() { reset(); }
+
+  void reset() {
+    _nframes = _nallocating = 0;
+    _nallocs = _bytes = 0;
+    _max = AllocCount();
+  }
+
+  //! add a frame that made the allocations \arg c
+  void add(const AllocCount & c) {
+    ++_nframes;
+    if (c.nallocs > 0)
+      ++_nallocating;
+    _nallocs += c.nallocs;
+    _bytes += c.bytes;
+    _max.nallocs = std::max(_max.nallocs, c.nallocs);
+    _max.bytes = std::max(_max.bytes, c.bytes);
+  }
+
+  inline unsigned long nframes() const { return _nframes; }
+  //! the number of frames that allocated
+  inline unsigned long nallocating() const { return _nallocating; }
+
+  //! print nothing if the allocations are not counted
+  void print_stats(const char* name) const {
+    if (!ALLOC_STATS || _nframes == 0)
+      return;
+    printf("%s: %lu frames, %lu with allocations, per frame: "
+           "%.2f allocations and %.0f bytes on average, at most %u and %u\n",
+           name, _nframes, _nallocating, 1. * _nallocs / _nframes,
+           1. * _bytes / _nframes, _max.nallocs, _max.bytes);
+  }
+
+private:
+  unsigned long _nframes, _nallocating;
+  unsigned long _nallocs, _bytes;
+  AllocCount _max;
+}; // end class AllocMeter
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! \return the resident memory of the process in bytes, 0 if unknown (not Linux)
+inline size_t resident_memory_bytes() {
+  FILE* file = fopen("/proc/self/statm", "r");
+  if (file == NULL)
+    return 0;
+  long npages = 0, nresident = 0;
+  int nread = fscanf(file, "%li %li", &npages, &nresident);
+  fclose(file);
+  return (nread == 2 ? nresident * sysconf(_SC_PAGESIZE) : 0);
+}
+
+#endif // ALLOC_STATS_H
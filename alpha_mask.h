@@ -0,0 +1,315 @@
+/*!
+  \file        alpha_mask.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+1-bit alpha masks for pixel-perfect collisions,
+and the kernels that test a span of pixels against two masks:
+a scalar one, an AVX2 one selected at runtime, and an SSE2 one for comparison.
+ */
+#ifndef ALPHA_MASK_H
+#define ALPHA_MASK_H
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_cpuinfo.h>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MASK_KERNELS_X86 1
+#include <immintrin.h>
+#else
+#define MASK_KERNELS_X86 0
+#endif
+
+//! the number of fractional bits of the fixed-point coordinates of the kernels
+#define MASK_FIXED_SHIFT    16
+#define MASK_FIXED_ONE      (1 << MASK_FIXED_SHIFT)
+
+/*! a packed 1-bit alpha mask: one bit per pixel,
+  set if the alpha of the pixel is above a threshold.
+  Rows are padded to 32-bit words.
+*/
+class AlphaMask {
+public:
+  AlphaMask() : _width(0), _height(0), _words_per_row(0) {}
+
+  void clear() {
+    _width = _height = _words_per_row = 0;
+    _bits.clear();
+  }
+
+  //! build the mask of a surface, with the pixels whose alpha >= \arg minalpha
+  bool from_surface(SDL_Surface* surface, int minalpha) {
+    clear();
+    if (surface == NULL)
+      return false;
+    // read the alpha channel as the 4th byte of each pixel
+    SDL_Surface* rgba = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_RGBA32, 0);
+    if (rgba == NULL) {
+      printf("AlphaMask::from_surface(): conversion failed: '%s'\n", SDL_GetError());
+      return false;
+    }
+    _width = rgba->w;
+    _height = rgba->h;
+    _words_per_row = (_width + 31) / 32;
+    _bits.resize(_words_per_row * _height, 0);
+    SDL_LockSurface(rgba);
+    for (int y = 0; y < _height; ++y) {
+      const Uint8* row = (const Uint8*) rgba->pixels + y * rgba->pitch;
+      Uint32* bits = &(_bits[y * _words_per_row]);
+      for (int x = 0; x < _width; ++x) {
+        if (row[4 * x + 3] >= minalpha)
+          bits[x >> 5] |= (1u << (x & 31));
+      } // end loop x
+    } // end loop y
+    SDL_UnlockSurface(rgba);
+    SDL_FreeSurface(rgba);
+    return true;
+  }
+
+  //! copy an already built mask, e.g. from an asset bundle
+  void from_words(int width, int height, const Uint32* words) {
+    _width = width;
+    _height = height;
+    _words_per_row = (_width + 31) / 32;
+    _bits.assign(words, words + _words_per_row * _height);
+  }
+
+  inline int get_width() const { return _width;}
+  inline int get_height() const { return _height;}
+  inline int get_words_per_row() const { return _words_per_row;}
+  inline const Uint32* get_words() const { return (_bits.empty() ? NULL : &(_bits[0])); }
+  inline size_t get_bytes() const { return _bits.size() * sizeof(Uint32); }
+  //! \pre (x, y) inside the mask
+  inline bool get(int x, int y) const {
+    return (_bits[y * _words_per_row + (x >> 5)] >> (x & 31)) & 1;
+  }
+
+private:
+  int _width, _height, _words_per_row;
+  std::vector<Uint32> _bits;
+}; // end AlphaMask
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! convert a coordinate in pixels to the fixed-point format of the kernels
+inline int to_mask_fixed(double v) {
+  return (int) floor(v * MASK_FIXED_ONE + .5);
+}
+
+/*! find the first pixel of a span set in both masks.
+ * The span is made of \arg n pixels. The fixed-point position in mask A of
+ * the t-th pixel is (ax, ay) + t * (adx, ady), the same in mask B.
+ * Positions out of a mask are clamped onto its border.
+ * All the kernels use the same integer arithmetic, hence give the same results.
+ * \return the index of the first pixel set in both, or -1 if none
+ */
+typedef int (*MaskSpanKernel)(const AlphaMask & A, int ax, int ay, int adx, int ady,
+                              const AlphaMask & B, int bx, int by, int bdx, int bdy,
+                              int n);
+
+inline int mask_span_first_hit_scalar(const AlphaMask & A, int ax, int ay, int adx, int ady,
+                                      const AlphaMask & B, int bx, int by, int bdx, int bdy,
+                                      int n) {
+  int axmax = A.get_width() - 1, aymax = A.get_height() - 1,
+      bxmax = B.get_width() - 1, bymax = B.get_height() - 1;
+  for (int t = 0; t < n; ++t) {
+    int pax = std::min(std::max(ax >> MASK_FIXED_SHIFT, 0), axmax),
+        pay = std::min(std::max(ay >> MASK_FIXED_SHIFT, 0), aymax),
+        pbx = std::min(std::max(bx >> MASK_FIXED_SHIFT, 0), bxmax),
+        pby = std::min(std::max(by >> MASK_FIXED_SHIFT, 0), bymax);
+    if (A.get(pax, pay) && B.get(pbx, pby))
+      return t;
+    ax += adx;
+    ay += ady;
+    bx += bdx;
+    by += bdy;
+  } // end loop t
+  return -1;
+}
+
+#if MASK_KERNELS_X86
+//! 32-bit a * b, without SSE4.1 _mm_mullo_epi32()
+__attribute__((target("sse2")))
+inline __m128i mask_mullo_sse2(const __m128i & a, const __m128i & b) {
+  __m128i even = _mm_mul_epu32(a, b),
+      odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+//! clamp(v, 0, vmax) without SSE4.1 _mm_max_epi32() and _mm_min_epi32()
+__attribute__((target("sse2")))
+inline __m128i mask_clamp_sse2(__m128i v, const __m128i & vmax) {
+  v = _mm_andnot_si128(_mm_srai_epi32(v, 31), v);
+  __m128i over = _mm_sub_epi32(v, vmax);
+  return _mm_sub_epi32(v, _mm_andnot_si128(_mm_srai_epi32(over, 31), over));
+}
+
+//! SSE2 has no gather: compute 4 word indices at once, then read the words
+__attribute__((target("sse2")))
+inline int mask_span_first_hit_sse2(const AlphaMask & A, int ax, int ay, int adx, int ady,
+                                    const AlphaMask & B, int bx, int by, int bdx, int bdy,
+                                    int n) {
+  const Uint32 *wA = A.get_words(), *wB = B.get_words();
+  const __m128i bit5 = _mm_set1_epi32(31),
+      wprA = _mm_set1_epi32(A.get_words_per_row()), wprB = _mm_set1_epi32(B.get_words_per_row()),
+      axmax = _mm_set1_epi32(A.get_width() - 1), aymax = _mm_set1_epi32(A.get_height() - 1),
+      bxmax = _mm_set1_epi32(B.get_width() - 1), bymax = _mm_set1_epi32(B.get_height() - 1);
+  __m128i vax = _mm_setr_epi32(ax, ax + adx, ax + 2 * adx, ax + 3 * adx),
+      vay = _mm_setr_epi32(ay, ay + ady, ay + 2 * ady, ay + 3 * ady),
+      vbx = _mm_setr_epi32(bx, bx + bdx, bx + 2 * bdx, bx + 3 * bdx),
+      vby = _mm_setr_epi32(by, by + bdy, by + 2 * bdy, by + 3 * bdy);
+  const __m128i sax = _mm_set1_epi32(4 * adx), say = _mm_set1_epi32(4 * ady),
+      sbx = _mm_set1_epi32(4 * bdx), sby = _mm_set1_epi32(4 * bdy);
+  Uint32 idxA[4], idxB[4], shiftA[4], shiftB[4];
+  for (int t = 0; t < n; t += 4) {
+    __m128i px = mask_clamp_sse2(_mm_srai_epi32(vax, MASK_FIXED_SHIFT), axmax),
+        py = mask_clamp_sse2(_mm_srai_epi32(vay, MASK_FIXED_SHIFT), aymax),
+        qx = mask_clamp_sse2(_mm_srai_epi32(vbx, MASK_FIXED_SHIFT), bxmax),
+        qy = mask_clamp_sse2(_mm_srai_epi32(vby, MASK_FIXED_SHIFT), bymax);
+    _mm_storeu_si128((__m128i*) idxA, _mm_add_epi32(mask_mullo_sse2(py, wprA), _mm_srli_epi32(px, 5)));
+    _mm_storeu_si128((__m128i*) idxB, _mm_add_epi32(mask_mullo_sse2(qy, wprB), _mm_srli_epi32(qx, 5)));
+    _mm_storeu_si128((__m128i*) shiftA, _mm_and_si128(px, bit5));
+    _mm_storeu_si128((__m128i*) shiftB, _mm_and_si128(qx, bit5));
+    // one bit per lane, a single branch for the 4 lanes
+    int hits = 0;
+    for (int l = 0; l < 4; ++l)
+      hits |= (((wA[idxA[l]] >> shiftA[l]) & (wB[idxB[l]] >> shiftB[l])) & 1) << l;
+    if (n - t < 4)
+      hits &= (1 << (n - t)) - 1;
+    if (hits)
+      return t + __builtin_ctz(hits);
+    vax = _mm_add_epi32(vax, sax);
+    vay = _mm_add_epi32(vay, say);
+    vbx = _mm_add_epi32(vbx, sbx);
+    vby = _mm_add_epi32(vby, sby);
+  } // end loop t
+  return -1;
+}
+
+/*! AVX2: 8 positions, 2 gathers and a movemask per iteration.
+ * Unrolling to 16 positions measured no faster: the gathers are the bottleneck.
+ */
+__attribute__((target("avx2")))
+inline int mask_span_first_hit_avx2(const AlphaMask & A, int ax, int ay, int adx, int ady,
+                                    const AlphaMask & B, int bx, int by, int bdx, int bdy,
+                                    int n) {
+  const int *wA = (const int*) A.get_words(), *wB = (const int*) B.get_words();
+  const __m256i zero = _mm256_setzero_si256(), lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+      bit5 = _mm256_set1_epi32(31),
+      wprA = _mm256_set1_epi32(A.get_words_per_row()), wprB = _mm256_set1_epi32(B.get_words_per_row()),
+      axmax = _mm256_set1_epi32(A.get_width() - 1), aymax = _mm256_set1_epi32(A.get_height() - 1),
+      bxmax = _mm256_set1_epi32(B.get_width() - 1), bymax = _mm256_set1_epi32(B.get_height() - 1);
+  __m256i vax = _mm256_add_epi32(_mm256_set1_epi32(ax), _mm256_mullo_epi32(lane, _mm256_set1_epi32(adx))),
+      vay = _mm256_add_epi32(_mm256_set1_epi32(ay), _mm256_mullo_epi32(lane, _mm256_set1_epi32(ady))),
+      vbx = _mm256_add_epi32(_mm256_set1_epi32(bx), _mm256_mullo_epi32(lane, _mm256_set1_epi32(bdx))),
+      vby = _mm256_add_epi32(_mm256_set1_epi32(by), _mm256_mullo_epi32(lane, _mm256_set1_epi32(bdy)));
+  const __m256i sax = _mm256_set1_epi32(8 * adx), say = _mm256_set1_epi32(8 * ady),
+      sbx = _mm256_set1_epi32(8 * bdx), sby = _mm256_set1_epi32(8 * bdy);
+  for (int t = 0; t < n; t += 8) {
+    __m256i px = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(vax, MASK_FIXED_SHIFT), zero), axmax),
+        py = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(vay, MASK_FIXED_SHIFT), zero), aymax),
+        qx = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(vbx, MASK_FIXED_SHIFT), zero), bxmax),
+        qy = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(vby, MASK_FIXED_SHIFT), zero), bymax);
+    __m256i idxA = _mm256_add_epi32(_mm256_mullo_epi32(py, wprA), _mm256_srli_epi32(px, 5)),
+        idxB = _mm256_add_epi32(_mm256_mullo_epi32(qy, wprB), _mm256_srli_epi32(qx, 5));
+    __m256i bitsA = _mm256_srlv_epi32(_mm256_i32gather_epi32(wA, idxA, 4), _mm256_and_si256(px, bit5)),
+        bitsB = _mm256_srlv_epi32(_mm256_i32gather_epi32(wB, idxB, 4), _mm256_and_si256(qx, bit5));
+    // move the bit of each lane to its sign, to read them all with movemask
+    int hits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(bitsA, bitsB), 31)));
+    if (n - t < 8)
+      hits &= (1 << (n - t)) - 1;
+    if (hits)
+      return t + __builtin_ctz(hits);
+    vax = _mm256_add_epi32(vax, sax);
+    vay = _mm256_add_epi32(vay, say);
+    vbx = _mm256_add_epi32(vbx, sbx);
+    vby = _mm256_add_epi32(vby, sby);
+  } // end loop t
+  return -1;
+}
+#endif // MASK_KERNELS_X86
+
+////////////////////////////////////////////////////////////////////////////////
+
+enum MaskKernelType {
+  MASK_KERNEL_SCALAR = 0,
+  MASK_KERNEL_SSE2   = 1,
+  MASK_KERNEL_AVX2   = 2,
+  NMASK_KERNELS      = 3
+};
+
+inline const char* mask_kernel_name(MaskKernelType type) {
+  static const char* names[NMASK_KERNELS] = { "scalar", "sse2", "avx2" };
+  return names[type];
+}
+
+//! \return true if the CPU can run the kernel
+inline bool mask_kernel_supported(MaskKernelType type) {
+#if MASK_KERNELS_X86
+  if (type == MASK_KERNEL_SSE2)
+    return SDL_HasSSE2();
+  if (type == MASK_KERNEL_AVX2)
+    return SDL_HasAVX2();
+#endif // MASK_KERNELS_X86
+  return (type == MASK_KERNEL_SCALAR);
+}
+
+/*! the fastest kernel supported by the CPU.
+ * Not SSE2: without gather, its 4 lanes read the words one by one,
+ * and cars_bench measures it slower than the scalar kernel.
+ * It can still be forced with set_mask_kernel().
+ */
+inline MaskKernelType best_mask_kernel() {
+  if (mask_kernel_supported(MASK_KERNEL_AVX2))
+    return MASK_KERNEL_AVX2;
+  return MASK_KERNEL_SCALAR;
+}
+
+//! the kernel used by the collisions, best_mask_kernel() by default
+inline MaskSpanKernel & mask_span_kernel() {
+  static MaskSpanKernel kernel = NULL;
+  if (kernel == NULL) {
+    MaskKernelType best = best_mask_kernel();
+    kernel = mask_span_first_hit_scalar;
+#if MASK_KERNELS_X86
+    if (best == MASK_KERNEL_AVX2)
+      kernel = mask_span_first_hit_avx2;
+#endif // MASK_KERNELS_X86
+  }
+  return kernel;
+}
+
+//! force the kernel used by the collisions
+//! \return false if the CPU does not support it
+inline bool set_mask_kernel(MaskKernelType type) {
+  if (!mask_kernel_supported(type))
+    return false;
+  mask_span_kernel() = mask_span_first_hit_scalar;
+#if MASK_KERNELS_X86
+  if (type == MASK_KERNEL_SSE2)
+    mask_span_kernel() = mask_span_first_hit_sse2;
+  else if (type == MASK_KERNEL_AVX2)
+    mask_span_kernel() = mask_span_first_hit_avx2;
+#endif // MASK_KERNELS_X86
+  return true;
+}
+
+#endif // ALPHA_MASK_H
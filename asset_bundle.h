@@ -0,0 +1,300 @@
+/*!
+  \file        asset_bundle.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+A binary bundle of pictures, already decoded and scaled, with their collision masks.
+It is written offline by cars_bake and memory-mapped by the game,
+so that the startup does not decode nor rescale any PNG.
+
+Layout of the file, in the byte order of the machine that baked it:
+  BundleHeader
+  BundleEntry[nentries]
+  for each entry, aligned on BUNDLE_ALIGN bytes:
+    the pixels, width x height in SDL_PIXELFORMAT_RGBA32, premultiplied alpha
+    the mask, height rows of mask_words_per_row 32-bit words (see AlphaMask)
+ */
+#ifndef ASSET_BUNDLE_H
+#define ASSET_BUNDLE_H
+
+#include "sdl_utils.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BUNDLE_MAGIC    "CARSBNDL"
+#define BUNDLE_VERSION  1
+#define BUNDLE_ALIGN    64
+#define BUNDLE_KEY_SIZE 112
+
+struct BundleHeader {
+  char magic[8];
+  Uint32 version, nentries;
+};
+
+struct BundleEntry {
+  char key[BUNDLE_KEY_SIZE]; //!< see AssetBundle::key()
+  Sint32 width, height, mask_words_per_row, padding;
+  double resize_scale;
+  Uint64 pixels_offset, mask_offset; //!< from the start of the file
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+class AssetBundle {
+public:
+  AssetBundle() : _data(NULL), _size(0) {}
+  ~AssetBundle() { close(); }
+
+  /*! the identifier of a picture loaded with Texture::from_file() parameters.
+   * \param name the path relative to the graphics folder, e.g. "fish/pez1.png"
+   */
+  static std::string key(const std::string & name,
+                         int goalwidth = -1, int goalheight = -1, double goalscale = -1,
+                         int mask_minalpha = 1) {
+    std::ostringstream out;
+    out.precision(17);
+    out << name << ':' << goalwidth << 'x' << goalheight << 'x' << goalscale
+        << ':' << mask_minalpha;
+    return out.str();
+  }
+
+  //! map a bundle file in memory. \return false if missing or invalid
+  bool open(const std::string & filename) {
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(BundleHeader)) {
+      ::close(fd);
+      return false;
+    }
+    // private writable mapping: pages are only copied if written,
+    // e.g. when a renderer needs straight colors
+    void* data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      printf("Could not map bundle '%s'\n", filename.c_str());
+      return false;
+    }
+    _data = (Uint8*) data;
+    _size = st.st_size;
+    const BundleHeader* header = (const BundleHeader*) _data;
+    if (memcmp(header->magic, BUNDLE_MAGIC, 8) != 0
+        || header->version != BUNDLE_VERSION
+        || sizeof(BundleHeader) + header->nentries * sizeof(BundleEntry) > _size) {
+      printf("Bundle '%s' is invalid or from another version\n", filename.c_str());
+      close();
+      return false;
+    }
+    // a truncated or corrupted entry is skipped: its picture is decoded from its PNG
+    const BundleEntry* entries = (const BundleEntry*) (_data + sizeof(BundleHeader));
+    _valid.resize(header->nentries);
+    unsigned int ninvalid = 0;
+    for (unsigned int i = 0; i < header->nentries; ++i) {
+      _valid[i] = is_valid(entries[i]);
+      if (!_valid[i])
+        ++ninvalid;
+    } // end loop i
+    if (ninvalid > 0)
+      printf("Bundle '%s': %i of %i entries are invalid, they will be decoded\n",
+             filename.c_str(), ninvalid, header->nentries);
+    DEBUG_PRINT("AssetBundle: '%s', %i entries\n", filename.c_str(), header->nentries);
+    return true;
+  } // end open()
+
+  void close() {
+    if (_data != NULL)
+      munmap(_data, _size);
+    _data = NULL;
+    _size = 0;
+    _valid.clear();
+  }
+
+  inline bool is_open() const { return _data != NULL; }
+
+  //! \return NULL if the picture is not in the bundle, or is invalid
+  const BundleEntry* find(const std::string & key) const {
+    if (!is_open())
+      return NULL;
+    const BundleHeader* header = (const BundleHeader*) _data;
+    const BundleEntry* entries = (const BundleEntry*) (_data + sizeof(BundleHeader));
+    for (unsigned int i = 0; i < header->nentries; ++i) {
+      if (_valid[i] && strncmp(entries[i].key, key.c_str(), BUNDLE_KEY_SIZE) == 0)
+        return &(entries[i]);
+    }
+    return NULL;
+  }
+
+  /*! load a picture without copying its pixels: the surface of the texture
+   * points into the mapped file, so the bundle must outlive the texture.
+   * \return false if the picture is not in the bundle
+   */
+  bool load_texture(SDL_Renderer* renderer, const std::string & key, Texture & tex) const {
+    const BundleEntry* e = find(key);
+    if (e == NULL)
+      return false;
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormatFrom
+        (_data + e->pixels_offset, e->width, e->height, 32, 4 * e->width, SDL_PIXELFORMAT_RGBA32);
+    if (surface == NULL) {
+      printf("Could not create surface for '%s':'%s'\n", key.c_str(), SDL_GetError());
+      return false;
+    }
+    AlphaMask mask;
+    mask.from_words(e->width, e->height, (const Uint32*) (_data + e->mask_offset));
+    return tex.from_surface(renderer, surface, e->resize_scale, mask, true, key);
+  }
+
+private:
+  //! \return true if the key is terminated and the pixels and the mask are in the file
+  bool is_valid(const BundleEntry & e) const {
+    static const Sint32 MAX_SIZE = 1 << 14; // px, so that the sizes do not overflow
+    if (memchr(e.key, 0, BUNDLE_KEY_SIZE) == NULL
+        || e.width <= 0 || e.height <= 0 || e.width > MAX_SIZE || e.height > MAX_SIZE
+        || e.mask_words_per_row != (e.width + 31) / 32
+        || e.pixels_offset % 4 != 0 || e.mask_offset % 4 != 0)
+      return false;
+    Uint64 pixels_bytes = 4 * (Uint64) e.width * e.height,
+        mask_bytes = 4 * (Uint64) e.mask_words_per_row * e.height;
+    return (e.pixels_offset <= _size && pixels_bytes <= _size - e.pixels_offset
+            && e.mask_offset <= _size && mask_bytes <= _size - e.mask_offset);
+  }
+
+  Uint8* _data;
+  size_t _size;
+  std::vector<unsigned char> _valid; //!< for each entry, set by open()
+}; // end class AssetBundle
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! collect pictures then write them in a bundle, see cars_bake
+class AssetBundleWriter {
+public:
+  //! \return false if the key is too long or the texture has no pixels
+  bool add(const std::string & key, const Texture & tex) {
+    if (key.size() >= BUNDLE_KEY_SIZE || tex.get_sdl_surface() == NULL) {
+      printf("Cannot bundle '%s'\n", key.c_str());
+      return false;
+    }
+    SDL_Surface* rgba = SDL_ConvertSurfaceFormat(tex.get_sdl_surface(), SDL_PIXELFORMAT_RGBA32, 0);
+    if (rgba == NULL) {
+      printf("Cannot convert '%s':'%s'\n", key.c_str(), SDL_GetError());
+      return false;
+    }
+    Item item;
+    item.key = key;
+    item.resize_scale = tex.get_resize_scale();
+    item.width = rgba->w;
+    item.height = rgba->h;
+    // premultiply the colors by the alpha
+    item.pixels.resize(4 * rgba->w * rgba->h);
+    SDL_LockSurface(rgba);
+    for (int y = 0; y < rgba->h; ++y) {
+      const Uint8* src = (const Uint8*) rgba->pixels + y * rgba->pitch;
+      Uint8* dst = &(item.pixels[4 * y * rgba->w]);
+      for (int x = 0; x < 4 * rgba->w; x += 4) {
+        for (unsigned int c = 0; c < 3; ++c)
+          dst[x + c] = (src[x + c] * src[x + 3] + 127) / 255;
+        dst[x + 3] = src[x + 3];
+      } // end loop x
+    } // end loop y
+    SDL_UnlockSurface(rgba);
+    SDL_FreeSurface(rgba);
+    const AlphaMask & mask = tex.get_mask();
+    item.mask_words_per_row = mask.get_words_per_row();
+    if (mask.get_words() != NULL)
+      item.mask.assign(mask.get_words(),
+                       mask.get_words() + mask.get_words_per_row() * mask.get_height());
+    _items.push_back(item);
+    return true;
+  } // end add()
+
+  bool write(const std::string & filename) const {
+    FILE* f = fopen(filename.c_str(), "wb");
+    if (f == NULL) {
+      printf("Could not write bundle '%s'\n", filename.c_str());
+      return false;
+    }
+    BundleHeader header;
+    memcpy(header.magic, BUNDLE_MAGIC, 8);
+    header.version = BUNDLE_VERSION;
+    header.nentries = _items.size();
+    // compute the offsets of the data
+    std::vector<BundleEntry> entries(_items.size());
+    Uint64 offset = align(sizeof(BundleHeader) + _items.size() * sizeof(BundleEntry));
+    for (unsigned int i = 0; i < _items.size(); ++i) {
+      const Item & item = _items[i];
+      BundleEntry & e = entries[i];
+      memset(&e, 0, sizeof(BundleEntry));
+      strncpy(e.key, item.key.c_str(), BUNDLE_KEY_SIZE - 1);
+      e.width = item.width;
+      e.height = item.height;
+      e.mask_words_per_row = item.mask_words_per_row;
+      e.resize_scale = item.resize_scale;
+      e.pixels_offset = offset;
+      offset = align(offset + item.pixels.size());
+      e.mask_offset = offset;
+      offset = align(offset + 4 * item.mask.size());
+    } // end loop i
+    bool ok = (fwrite(&header, sizeof(BundleHeader), 1, f) == 1);
+    if (!entries.empty())
+      ok = ok && (fwrite(&(entries[0]), sizeof(BundleEntry), entries.size(), f) == entries.size());
+    for (unsigned int i = 0; i < _items.size() && ok; ++i) {
+      ok = ok && pad_to(f, entries[i].pixels_offset);
+      ok = ok && (fwrite(&(_items[i].pixels[0]), 1, _items[i].pixels.size(), f)
+                  == _items[i].pixels.size());
+      ok = ok && pad_to(f, entries[i].mask_offset);
+      if (!_items[i].mask.empty())
+        ok = ok && (fwrite(&(_items[i].mask[0]), 4, _items[i].mask.size(), f)
+                    == _items[i].mask.size());
+    } // end loop i
+    ok = (fclose(f) == 0) && ok;
+    if (!ok)
+      printf("Error while writing bundle '%s'\n", filename.c_str());
+    return ok;
+  } // end write()
+
+  inline unsigned int size() const { return _items.size(); }
+
+private:
+  struct Item {
+    std::string key;
+    int width, height, mask_words_per_row;
+    double resize_scale;
+    std::vector<Uint8> pixels;
+    std::vector<Uint32> mask;
+  };
+
+  static inline Uint64 align(Uint64 offset) {
+    return (offset + BUNDLE_ALIGN - 1) / BUNDLE_ALIGN * BUNDLE_ALIGN;
+  }
+  //! write zeros up to \arg offset
+  static bool pad_to(FILE* f, Uint64 offset) {
+    long pos = ftell(f);
+    for (; pos >= 0 && (Uint64) pos < offset; ++pos) {
+      if (fputc(0, f) == EOF)
+        return false;
+    }
+    return (pos >= 0);
+  }
+
+  std::vector<Item> _items;
+}; // end class AssetBundleWriter
+
+#endif // ASSET_BUNDLE_H
@@ -0,0 +1,213 @@
+/*!
+  \file        asset_loader.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+Loading of the pictures and sounds on a thread pool,
+with the loading time of each asset.
+ */
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include "asset_bundle.h"
+#include "thread_pool.h"
+
+/*! Queue the assets with add_texture() and add_sound(), then start().
+  The pictures are decoded, scaled and masked by the workers,
+  or taken from the asset bundle, but not uploaded:
+  the SDL_Textures must then be created by the rendering thread,
+  e.g. by TextureAtlas::build() or Texture::upload().
+  The caller polls wait() to follow the progress.
+*/
+class AssetLoader {
+public:
+  AssetLoader(const std::string & graphics_path, const AssetBundle & bundle)
+    : _graphics_path(graphics_path), _bundle(bundle), _pool(NULL), _nthreads(0), _nfinished(0), _wall_ms(0) {
+    _mutex = SDL_CreateMutex();
+    _cond = SDL_CreateCond();
+  }
+  //! \pre the jobs are finished, e.g. with ThreadPool::wait()
+  ~AssetLoader() {
+    for (unsigned int i = 0; i < _jobs.size(); ++i)
+      delete _jobs[i];
+    SDL_DestroyCond(_cond);
+    SDL_DestroyMutex(_mutex);
+  }
+
+  /*! queue a picture, with the parameters of Texture::from_file().
+   * \param name the path relative to the graphics folder
+   * \param scale_of if >= 0, the id of a picture whose resize scale is
+   *    used as goalscale: this picture is then loaded after it.
+   * \return the id of the picture
+   */
+  int add_texture(Texture* tex, const std::string & name,
+                  int goalwidth = -1, int goalheight = -1, double goalscale = -1,
+                  int mask_minalpha = 1, int scale_of = -1) {
+    TextureJob* job = new TextureJob(this, tex, name);
+    job->goalwidth = goalwidth;
+    job->goalheight = goalheight;
+    job->goalscale = goalscale;
+    job->mask_minalpha = mask_minalpha;
+    if (scale_of >= 0) {
+      job->scale_of = (TextureJob*) _jobs[scale_of];
+      job->has_parent = true;
+      _jobs[scale_of]->followers.push_back(job);
+    }
+    _jobs.push_back(job);
+    return _jobs.size() - 1;
+  }
+
+  //! queue a sound effect, decoded with Mix_LoadWAV() into \arg chunk
+  void add_sound(Mix_Chunk** chunk, const std::string & filename) {
+    _jobs.push_back(new SoundJob(this, chunk, filename));
+  }
+
+  //! add a step done by the caller to the report
+  void add_timing(const std::string & name, double ms) {
+    _timings.push_back(std::make_pair(name, ms));
+  }
+
+  //! start the jobs that do not wait for another one
+  void start(ThreadPool & pool) {
+    _pool = &pool;
+    _nthreads = pool.get_nthreads();
+    _timer.reset();
+    for (unsigned int i = 0; i < _jobs.size(); ++i) {
+      if (!_jobs[i]->has_parent)
+        _pool->push(_jobs[i]);
+    }
+  }
+
+  //! wait at most \arg timeout_ms for more assets.
+  //! \return the number of finished assets
+  unsigned int wait(int timeout_ms) {
+    SDL_LockMutex(_mutex);
+    if (_nfinished < _jobs.size())
+      SDL_CondWaitTimeout(_cond, _mutex, timeout_ms);
+    unsigned int nfinished = _nfinished;
+    SDL_UnlockMutex(_mutex);
+    return nfinished;
+  }
+
+  inline unsigned int size() const { return _jobs.size(); }
+
+  //! \pre all the assets are finished
+  bool ok() const {
+    for (unsigned int i = 0; i < _jobs.size(); ++i) {
+      if (!_jobs[i]->ok)
+        return false;
+    }
+    return true;
+  }
+
+  //! \pre all the assets are finished
+  void print_report() const {
+    double decode_ms = 0;
+    printf("Startup timing (ms):\n");
+    for (unsigned int i = 0; i < _jobs.size(); ++i) {
+      printf("  %-40s %8.2f%s\n", _jobs[i]->name.c_str(), _jobs[i]->ms,
+             (_jobs[i]->ok ? "" : " FAILED"));
+      decode_ms += _jobs[i]->ms;
+    }
+    for (unsigned int i = 0; i < _timings.size(); ++i)
+      printf("  %-40s %8.2f\n", _timings[i].first.c_str(), _timings[i].second);
+    printf("  %i assets decoded in %.2f ms on %i threads (%.2f ms of work)\n",
+           (int) _jobs.size(), _wall_ms, _nthreads, decode_ms);
+  }
+
+private:
+  class AssetJob : public Job {
+  public:
+    AssetJob(AssetLoader* loader_, const std::string & name_)
+      : loader(loader_), name(name_), ms(0), ok(false), has_parent(false) {}
+    void run() {
+      TraceScope trace(name.c_str());
+      Timer timer;
+      ok = load();
+      ms = 1000 * timer.getTimeSeconds();
+      loader->finished(this);
+    }
+    virtual bool load() = 0;
+    AssetLoader* loader;
+    std::string name;
+    double ms;
+    bool ok, has_parent;
+    std::vector<AssetJob*> followers; //!< started when this one is finished
+  }; // end class AssetJob
+
+  class TextureJob : public AssetJob {
+  public:
+    TextureJob(AssetLoader* loader_, Texture* tex_, const std::string & name_)
+      : AssetJob(loader_, name_), tex(tex_), scale_of(NULL) {}
+    bool load() {
+      if (scale_of != NULL)
+        goalscale = scale_of->tex->get_resize_scale();
+      std::string key = AssetBundle::key(name, goalwidth, goalheight, goalscale, mask_minalpha);
+      {
+        TraceScope trace("AssetBundle::load_texture");
+        if (loader->_bundle.load_texture(NULL, key, *tex))
+          return true;
+      }
+      if (loader->_bundle.is_open())
+        printf("'%s' is not in the asset bundle, run cars_bake again\n", key.c_str());
+      return tex->decode_file(loader->_graphics_path + name,
+                              goalwidth, goalheight, goalscale, mask_minalpha);
+    }
+    Texture* tex;
+    int goalwidth, goalheight, mask_minalpha;
+    double goalscale;
+    TextureJob* scale_of;
+  }; // end class TextureJob
+
+  class SoundJob : public AssetJob {
+  public:
+    SoundJob(AssetLoader* loader_, Mix_Chunk** chunk_, const std::string & filename)
+      : AssetJob(loader_, filename), chunk(chunk_) {}
+    bool load() {
+      TraceScope trace("Mix_LoadWAV");
+      *chunk = Mix_LoadWAV(name.c_str());
+      if (*chunk == NULL)
+        printf( "Failed to load sound '%s'! SDL_mixer Error: %s\n", name.c_str(), Mix_GetError() );
+      return (*chunk != NULL);
+    }
+    Mix_Chunk** chunk;
+  }; // end class SoundJob
+
+  //! called by the workers
+  void finished(AssetJob* job) {
+    for (unsigned int i = 0; i < job->followers.size(); ++i)
+      _pool->push(job->followers[i]);
+    SDL_LockMutex(_mutex);
+    if (++_nfinished == _jobs.size())
+      _wall_ms = 1000 * _timer.getTimeSeconds();
+    SDL_CondSignal(_cond);
+    SDL_UnlockMutex(_mutex);
+  }
+
+  std::string _graphics_path;
+  const AssetBundle & _bundle;
+  ThreadPool* _pool;
+  unsigned int _nthreads;
+  std::vector<AssetJob*> _jobs;
+  std::vector< std::pair<std::string, double> > _timings;
+  SDL_mutex* _mutex;
+  SDL_cond* _cond;
+  unsigned int _nfinished;
+  Timer _timer;
+  double _wall_ms;
+}; // end class AssetLoader
+
+#endif // ASSET_LOADER_H
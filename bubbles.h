@@ -0,0 +1,188 @@
+/*!
+  \file        bubbles.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+The bubbles, as a pool of particles stored as a structure of arrays.
+ */
+#ifndef BUBBLES_H
+#define BUBBLES_H
+
+#include "job_system.h"
+#include "sdl_utils.h"
+
+//! bubbles to create later, e.g. emitted by entities updated in parallel
+class BubbleBuffer {
+public:
+  BubbleBuffer() { _bubbles.reserve(64); }
+  //! the capacity is not kept by the copies, e.g. in a std::vector
+  inline void reserve(unsigned int n) { _bubbles.reserve(n); }
+  inline void add(const Point2d & pos, const double & rendering_scale) {
+    _bubbles.push_back(std::make_pair(pos, rendering_scale));
+  }
+  inline unsigned int size() const { return _bubbles.size(); }
+  inline void clear() { _bubbles.clear(); }
+  inline const Point2d & position(unsigned int i) const { return _bubbles[i].first; }
+  inline double scale(unsigned int i) const { return _bubbles[i].second; }
+private:
+  std::vector< std::pair<Point2d, double> > _bubbles;
+}; // end class BubbleBuffer
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*! A fixed-capacity particle system for the bubbles.
+  Each field of the bubbles is stored in its own array,
+  all allocated once by set_capacity(), e.g. to max_alive().
+  The bubbles created when it is full are dropped and counted.
+  Dead bubbles are replaced by the last one (swap-remove),
+  so that creating, updating and removing bubbles never allocates.
+  update() can move the bubbles in parallel chunks:
+  the dead ones are then removed in order, as in a sequential loop.
+*/
+class BubbleManager {
+public:
+  BubbleManager() : _tex(NULL), _tex_radius(0), _size(0), _next_id(0), _ndropped(0) {}
+
+  void set_texture(Texture* tex) {
+    _tex = tex;
+    _tex_radius = hypot(tex->get_width(), tex->get_height()) / 2;
+  }
+
+  //! allocate the arrays: at most \arg capacity bubbles can live together
+  void set_capacity(unsigned int capacity) {
+    _x.resize(capacity);
+    _y.resize(capacity);
+    _vx.resize(capacity);
+    _vy.resize(capacity);
+    _scale.resize(capacity);
+    _age.resize(capacity);
+    _dead.resize(capacity);
+    _id.resize(capacity);
+    _size = std::min(_size, capacity);
+  }
+  inline unsigned int capacity() const { return _x.size(); }
+
+  /*! the number of bubbles alive together at most, if \arg nemitters
+   * each create \arg rate bubbles per second: a bubble rises out of
+   * a window of height \arg winh in a few seconds.
+   * \pre set_texture()
+   */
+  unsigned int max_alive(unsigned int nemitters, double rate, int winh) const {
+    // from the bottom to above the top, for bubbles up to twice the texture
+    double lifetime = (winh + 4 * _tex_radius) / MIN_RISE_SPEED; // seconds
+    return nemitters * (unsigned int) ceil(rate * lifetime);
+  }
+  inline unsigned int size() const { return _size; }
+  inline void clear() { _size = 0; }
+
+  //! \return false if the pool is full: the bubble is then dropped
+  bool create_bubble(const Point2d & pos, const double & rendering_scale) {
+    if (_size >= capacity()) {
+      ++_ndropped;
+      return false;
+    }
+    _x[_size] = pos.x;
+    _y[_size] = pos.y;
+    _vx[_size] = 0;
+    _vy[_size] = -MIN_RISE_SPEED - rand()%100;
+    _scale[_size] = rendering_scale;
+    _age[_size] = 0;
+    _id[_size] = _next_id++;
+    ++_size;
+    return true;
+  }
+
+  //! create the bubbles of \arg buffer, in its order
+  void create_bubbles(const BubbleBuffer & buffer) {
+    for (unsigned int i = 0; i < buffer.size(); ++i)
+      create_bubble(buffer.position(i), buffer.scale(i));
+  }
+
+  //! \arg jobs if not NULL, moves the bubbles in parallel chunks
+  void update(const SimClock & clock, int winw, int winh, JobSystem* jobs = NULL) {
+    UpdateJob job(this, clock.dt(), winw, winh);
+    if (jobs != NULL)
+      jobs->parallel_for(job, _size, CHUNK_SIZE);
+    else
+      job.run(0, _size, 0);
+    // swap-remove the bubbles out of the window, the last ones come in their place
+    for (unsigned int i = 0; i < _size; ++i) {
+      while (i < _size && _dead[i])
+        remove(i);
+    }
+  } // end update()
+
+  inline Point2d get_position(unsigned int i) const { return Point2d(_x[i], _y[i]); }
+  inline double get_scale(unsigned int i) const { return _scale[i]; }
+  //! a number given to each bubble at its creation, kept when it moves in the arrays
+  inline unsigned int get_id(unsigned int i) const { return _id[i]; }
+  //! the bubbles not created because the pool was full, since the start
+  inline unsigned int ndropped() const { return _ndropped; }
+
+private:
+  static const unsigned int CHUNK_SIZE = 1024;
+  static const int MIN_RISE_SPEED = 30; // px/s
+
+  //! move the bubbles of a chunk, and mark the ones out of the window
+  class UpdateJob : public RangeJob {
+  public:
+    UpdateJob(BubbleManager* man_, double dt_, int winw_, int winh_)
+      : man(*man_), dt(dt_), winw(winw_), winh(winh_) {}
+    void run(unsigned int begin, unsigned int end, unsigned int) {
+      if (begin >= end)
+        return;
+      double phase = man._tex->get_width(), tex_radius = man._tex_radius;
+      double *x = &man._x[0], *y = &man._y[0], *vx = &man._vx[0], *vy = &man._vy[0],
+          *age = &man._age[0];
+      const double* scale = &man._scale[0];
+      unsigned char* dead = &man._dead[0];
+      for (unsigned int i = begin; i < end; ++i) {
+        vx[i] = 100*cos(3*age[i]+phase); // make bubble oscillate
+        age[i] += dt;
+        x[i] += dt * vx[i];
+        y[i] += dt * vy[i];
+        double radius = tex_radius * scale[i];
+        dead[i] = (x[i] < -radius || x[i] > winw + radius
+                   || y[i] < -radius || y[i] > winh + radius);
+      } // end loop i
+    }
+    BubbleManager & man;
+    double dt;
+    int winw, winh;
+  }; // end class UpdateJob
+
+  //! swap-remove: move the last bubble into \arg i
+  inline void remove(unsigned int i) {
+    --_size;
+    _x[i] = _x[_size];
+    _y[i] = _y[_size];
+    _vx[i] = _vx[_size];
+    _vy[i] = _vy[_size];
+    _scale[i] = _scale[_size];
+    _age[i] = _age[_size];
+    _dead[i] = _dead[_size];
+    _id[i] = _id[_size];
+  }
+
+  Texture* _tex;
+  double _tex_radius;
+  unsigned int _size, _next_id, _ndropped;
+  std::vector<double> _x, _y, _vx, _vy, _scale, _age;
+  std::vector<unsigned char> _dead; //!< set by update()
+  std::vector<unsigned int> _id;
+}; // end class BubbleManager
+
+#endif // BUBBLES_H
@@ -1,6 +1,16 @@
 #include <iostream>
 #include <algorithm>
+#include "alloc_stats.h"
+#include "asset_loader.h"
+#include "bubbles.h"
+#include "entity.h"
+#include "glyph_cache.h"
+#include "profiler.h"
+#include "resource_cache.h"
 #include "sdl_utils.h"
+#include "spatial_grid.h"
+#include "texture_atlas.h"
+#include "world_snapshot.h"
 
 
 enum GameStatus {
@@ -17,23 +27,23 @@ public:
     double x = 0, y = 0, angle  = 0;
     int border = rand() % 4;
     if (border == 0) { // left
-      x = -_tex_radius+1;
+      x = -get_tex_radius()+1;
       y = rand() % winh;
       angle = -M_PI_2 + drand48() * M_PI;
     }
     else if (border == 1) { // up
       x = rand() % winw;
-      y = -_tex_radius+1;
+      y = -get_tex_radius()+1;
       angle = -M_PI + drand48() * M_PI;
     }
     else if (border == 2) { // right
-      x = winw + _tex_radius-1;
+      x = winw + get_tex_radius()-1;
       y = rand() % winh;
       angle = M_PI_2 + drand48() * M_PI;
     }
     else if (border == 3) { // down
       x = rand() % winw;
-      y = winh + _tex_radius-1;
+      y = winh + get_tex_radius()-1;
       angle = drand48() * M_PI;
     }
     set_position(Point2d(x, y));
@@ -45,12 +55,22 @@ public:
 
   //////////////////////////////////////////////////////////////////////////////
 
-  void update(int winw, int winh) {
-    set_tan_nor_speed(Point2d( _tan_speed, _nor_speed * cos(_oscil_period*get_life_timer()) ));
+  /*! \return false if the fish left the window: it must then be moved
+   * by respawn(), that uses rand() hence must be called in order by one thread.
+   */
+  bool update(const SimClock & clock, int winw, int winh) {
+    set_tan_nor_speed(Point2d( _tan_speed, _nor_speed * cos(_oscil_period*get_age()) ));
     rotate_towards_speed_direction();
     if (!is_visible(winw, winh))
-      move_random_border(winw, winh);
-    Entity::update_pos_speed();
+      return false;
+    Entity::update_pos_speed(clock.dt());
+    return true;
+  }
+
+  //! the end of update() for a fish out of the window
+  void respawn(const SimClock & clock, int winw, int winh) {
+    move_random_border(winw, winh);
+    Entity::update_pos_speed(clock.dt());
   }
 
 protected:
@@ -59,50 +79,11 @@ protected:
 
 ////////////////////////////////////////////////////////////////////////////////
 
-class BubbleManager {
-public:
-  void set_texture(Texture* tex) {
-    _tex = tex;
-  }
-  void create_bubble(const Point2d & pos, const double & rendering_scale) {
-    Entity b;
-    b.set_position(pos);
-    b.set_rendering_scale(rendering_scale);
-    b.set_speed(Point2d(0, -30 - rand()%100));
-    b.set_texture(_tex);
-    _bubbles.push_back(b);
-  }
-
-  void update(int winw, int winh) {
-    for (unsigned int i = 0; i < _bubbles.size(); ++i) {
-      Entity* b = &(_bubbles[i]);
-      double speedx = 100*cos(3*b->get_life_timer()+b->get_width());
-      b->set_speed( Point2d( speedx, b->get_speed().y));// make bubble oscillate
-      b->update_pos_speed();
-      if (!b->is_visible(winw, winh)) {
-        _bubbles.erase(_bubbles.begin() + i);
-        --i;
-      }
-    }
-  } // end update()
-
-  bool render(SDL_Renderer* renderer) {
-    DEBUG_PRINT("BubbleManager::render()\n");
-    bool ok = true;
-    for (unsigned int i = 0; i < _bubbles.size(); ++i) {
-      ok = ok && _bubbles[i].render(renderer);
-    }
-    return ok;
-  }
-
-  std::vector<Entity> _bubbles;
-  Texture* _tex;
-}; // end class BubbleManager
-
-////////////////////////////////////////////////////////////////////////////////
-
 class Car : public Entity {
 public:
+  Car() : rank(-1), _rand_seed(1) {}
+
+  //! \pre create() was called: the wheels are created after the car
   bool set_textures(Texture* car_texture,
                     const Point2d & front_wheel_center_offset,
                     Texture* front_wheel_texture,
@@ -116,8 +97,10 @@ public:
     }
     // set default values
     Entity front_wheel, back_wheel;
+    front_wheel.create(*_store);
     front_wheel.set_texture(front_wheel_texture);
     add_child(car_texture->get_resize_scale() * front_wheel_center_offset, front_wheel);
+    back_wheel.create(*_store);
     back_wheel.set_texture(back_wheel_texture);
     add_child(car_texture->get_resize_scale() * back_wheel_center_offset, back_wheel);
     _exhaust_pipe_offset       = car_texture->get_resize_scale() * exhaust_pipe_offset;
@@ -127,42 +110,62 @@ public:
 
   //////////////////////////////////////////////////////////////////////////////
 
-  void update(int winw, int winh, BubbleManager* bubble_gen) {
+  //! the seed of the random numbers of this car, that can then be updated by any thread
+  inline void set_rand_seed(unsigned int seed) { _rand_seed = seed; }
+
+  //! a basic autopilot, used in headless mode: accelerate towards a target
+  void steer_towards(const Point2d & target) {
+    EntityStore::Kinematics & k = kinematics();
+    k.accel = target - get_position();
+    k.accel.renorm(300);
+    if (k.speed.norm() > 300) k.speed.renorm(300);
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+
+  //! \arg bubbles receives the bubbles emitted by the car
+  void update(const SimClock & clock, int winw, int winh, BubbleBuffer & bubbles) {
+    EntityStore::Kinematics & k = kinematics();
+    Point2d & speed = k.speed, & accel = k.accel;
+    const Point2d & position = transform().position;
+    double tex_radius = get_tex_radius();
     // orientate car in direction of speed
-    if (_speed.norm() > 10)
+    if (speed.norm() > 10)
       rotate_towards_speed_direction();
     // turn wheels faster if car faster
-    double wheel_speed = hypot(_speed.y, _speed.x) / 10;
-    Entity::update_pos_speed();
-    for (unsigned int i = 0; i < _children.size(); ++i)
-      _children[i].second.set_angspeed(wheel_speed);
+    double wheel_speed = hypot(speed.y, speed.x) / 10;
+    Entity::update_pos_speed(clock.dt());
+    for (unsigned int i = 0; i < get_nchildren(); ++i)
+      get_child(i).set_angspeed(wheel_speed);
     // stop if going out of the screen
-    if (_position.x < _tex_radius) { // left
-      _accel.x = std::max(_accel.x + 10, 20.);
-      if (_speed.norm() > 100) _speed.renorm(100);
+    if (position.x < tex_radius) { // left
+      accel.x = std::max(accel.x + 10, 20.);
+      if (speed.norm() > 100) speed.renorm(100);
     }
-    else if (_position.x > winw - _tex_radius) { // right
-      _accel.x = std::min(_accel.x - 10, -20.);
-      if (_speed.norm() > 100) _speed.renorm(100);
+    else if (position.x > winw - tex_radius) { // right
+      accel.x = std::min(accel.x - 10, -20.);
+      if (speed.norm() > 100) speed.renorm(100);
     }
-    if (_position.y < _tex_radius) { // up
-      _accel.y = std::max(_accel.y + 10, 20.);
-      if (_speed.norm() > 100) _speed.renorm(100);
+    if (position.y < tex_radius) { // up
+      accel.y = std::max(accel.y + 10, 20.);
+      if (speed.norm() > 100) speed.renorm(100);
     }
-    else if (_position.y > winh - _tex_radius) { // down
-      _accel.y = std::min(_accel.y - 10, -20.);
-      if (_speed.norm() > 100) _speed.renorm(100);
+    else if (position.y > winh - tex_radius) { // down
+      accel.y = std::min(accel.y - 10, -20.);
+      if (speed.norm() > 100) speed.renorm(100);
     }
     // create bubbles randomly or if accelerating
-    if ((rand() % 2000 + _accel.norm()) > 1950) {
+    if ((rand_r(&_rand_seed) % 2000 + accel.norm()) > 1950) {
       Point2d ex = offset2world_pos(_exhaust_pipe_offset);
-      bubble_gen->create_bubble(ex, .2 + .5 * drand48() + _accel.norm() / 2000.); // bigger if accelerating
+      double r = rand_r(&_rand_seed) / (RAND_MAX + 1.);
+      bubbles.add(ex, .2 + .5 * r + accel.norm() / 2000.); // bigger if accelerating
     }
   }
 
   int rank;
 protected:
   Point2d _exhaust_pipe_offset;
+  unsigned int _rand_seed;
 }; // end class Car
 
 
@@ -170,27 +173,30 @@ protected:
 
 class Candy : public Entity {
 public:
-  Candy() : _tex_idx(-1) {
+  Candy() : _candy_textures(NULL), _tex_idx(-1) {
     _need_respawn = true;
+    _spawn_time = 0;
   }
 
-  bool set_textures(std::vector<Texture*> & candy_texture_ptrs) {
-    _candy_textures = candy_texture_ptrs;
-    set_texture(_candy_textures.back());
+  //! \arg candy_textures must outlive the candy
+  bool set_textures(std::vector<Texture> & candy_textures) {
+    _candy_textures = &candy_textures;
+    set_texture(&_candy_textures->back());
     _need_respawn = true;
     return true;
   }
 
-  void move_far_away() { set_position(Point2d(-_entity_radius, -_entity_radius)); }
+  void move_far_away() { set_position(Point2d(-get_entity_radius(), -get_entity_radius())); }
 
-  bool respawn(int winw, int winh, std::vector<Car> & cars){
-    if (_candy_textures.empty()) {
+  bool respawn(const SimClock & clock, int winw, int winh, std::vector<Car> & cars){
+    if (_candy_textures == NULL || _candy_textures->empty()) {
       printf("Cannot respawn candy without texture!\n");
       return false;
     }
     _need_respawn = false;
-    _tex_idx = rand() % _candy_textures.size();
-    set_texture(_candy_textures[_tex_idx]);
+    _spawn_time = clock.now();
+    _tex_idx = rand() % _candy_textures->size();
+    set_texture(&(*_candy_textures)[_tex_idx]);
     Point2d old_pos = get_position();
     for (int tryidx = 0; tryidx < 100; ++tryidx) {
       bool ok = true;
@@ -213,15 +219,21 @@ public:
     return true;
   } // end respawn()
 
-  bool update(int winw, int winh, std::vector<Car> & cars) {
+  bool update(const SimClock & clock, int winw, int winh, std::vector<Car> & cars) {
     if (get_position().x <= 0)
-      return respawn(winw, winh, cars);
+      return respawn(clock, winw, winh, cars);
     return true;
   } // end update()
 
-  std::vector<Texture*> _candy_textures;
+  //! the simulated time since the last respawn (seconds)
+  double get_time_since_spawn(const SimClock & clock) const {
+    return clock.now() - _spawn_time;
+  }
+
+  std::vector<Texture>* _candy_textures;
   unsigned int _tex_idx;
   bool _need_respawn;
+  double _spawn_time;
 }; // end class Candy
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -231,16 +243,52 @@ class Game {
 public:
   static const double GAME_LENGTH = 45; // seconds
   static const double COUNTDOWN_LENGTH = 5; // seconds
+  static const int TICK_RATE = 20; // Hz, rate of the simulation clock
+  static const unsigned int FRAME_ARENA_SIZE = 64 * 1024; // bytes, grows if needed
+  //! the phases of a frame timed by the profiler, in the order of init_profiler()
+  enum ProfileSection {
+    PROFILE_UPDATE, PROFILE_STATUS, PROFILE_CARS, PROFILE_FISHES, PROFILE_CANDIES,
+    PROFILE_BUBBLES, PROFILE_TRANSFORMS, PROFILE_COLLISIONS, PROFILE_EVENTS, PROFILE_SNAPSHOT,
+    PROFILE_RENDER, PROFILE_ENTITIES, PROFILE_HUD, PROFILE_PRESENT
+  };
 
+  /*! \param headless
+   *    if true, no window, renderer, audio or fonts are created:
+   *    only the simulation and the collisions run, on the CPU-side surfaces.
+   *    The game is then driven with run_headless_race().
+   *  \param vsync
+   *    if true, SDL_RenderPresent() waits for the vertical blank
+   *  \param nthreads
+   *    the number of threads updating the entities, by default one per core.
+   *    The game is the same whatever this number.
+   *  \param keep_surfaces
+   *    if true, the pixels of the pictures stay in memory once uploaded.
+   *    Otherwise, the cars and candies only keep their collision masks.
+   */
   bool init(unsigned int winw, unsigned int winh,
-            const std::vector<std::string> & player_names) {
+            const std::vector<std::string> & player_names,
+            bool headless = false, bool vsync = false, int nthreads = -1,
+            bool keep_surfaces = false) {
+    TraceScope trace("Game::init");
     _game_status = GAME_STATUS_WAITING;
+    _headless = headless;
+    _threaded = false;
+    _clock = SimClock(TICK_RATE);
+    _status_start_time = 0;
+    init_profiler();
     _nplayers = player_names.size();
+    _autopilot = headless;
     _winw = winw;
     _winh  = winh; // pixels
-    unsigned int nfishes = 15;
+    unsigned int nfishes = 15, ncandies = 1;
+    window = NULL;
+    renderer = NULL;
+    _score_font = _time_font = NULL;
+    _music = NULL;
+    _grab_collectable_sfx = _last_lap_fanfare_sfx = _pre_start_race_sfx
+        = _race_finish_sfx = _start_race_sfx = _track_intro_sfx = NULL;
 
-    if ( SDL_Init( SDL_INIT_EVERYTHING ) == -1 ) {
+    if ( SDL_Init( _headless ? SDL_INIT_TIMER : SDL_INIT_EVERYTHING ) == -1 ) {
       std::cout << " Failed to initialize SDL : " << SDL_GetError() << std::endl;
       return false;
     }
@@ -250,42 +298,8 @@ public:
       printf( "SDL_image could not initialize! SDL_image Error: %s\n", IMG_GetError() );
       return false;
     }
-    //Initialize SDL_mixer
-    if( Mix_OpenAudio( 44100, MIX_DEFAULT_FORMAT, 2, 2048 ) < 0 ) {
-      printf( "SDL_mixer could not initialize! SDL_mixer Error: %s\n", Mix_GetError() );
-      return false;
-    }
-    //Initialize SDL_ttf
-    if( TTF_Init() == -1 ) {
-      printf( "SDL_ttf could not initialize! SDL_ttf Error: %s\n", TTF_GetError() );
-      return false;
-    }
-    // create window
-    SDL_Rect windowRect = { 10, 10, _winw, _winh};
-    window = SDL_CreateWindow( "cars", windowRect.x, windowRect.y, _winw, _winh, 0 );
-    if ( window == NULL ) {
-      std::cout << "Failed to create window : " << SDL_GetError();
-      return false;
-    }
-    // create renderer
-    renderer = SDL_CreateRenderer( window, -1, 0 );
-    if ( renderer == NULL ) {
-      std::cout << "Failed to create renderer : " << SDL_GetError();
+    if (!_headless && !init_display_and_audio(vsync))
       return false;
-    }
-    // Set size of renderer to the same as window
-    SDL_RenderSetLogicalSize( renderer, _winw, _winh );
-    // Set color of renderer to light blue
-    SDL_SetRenderDrawColor( renderer, 150, 150, 255, 255 );
-    //Check for joysticks
-    gameControllers.resize(SDL_NumJoysticks());
-    for (int i = 0; i < SDL_NumJoysticks(); ++i) {
-      gameControllers[i] = SDL_JoystickOpen( i );
-      if(gameControllers[i] == NULL )
-        printf( "Warning: Unable to open game controller! SDL Error: %s\n", SDL_GetError() );
-      else
-        DEBUG_PRINT( "Joystick %i connected\n", i);
-    }
 
     ///
     /// load data
@@ -294,64 +308,32 @@ public:
         data_path = base_path + "../data/",
         graphics_path = data_path + "graphics/";
     DEBUG_PRINT("base_path:'%s'\n", base_path.c_str());
-    //Open the score font
-    _score_font = TTF_OpenFont( (data_path + "fonts/LCD2U___.TTF").c_str(), 40 );
-    if( _score_font == NULL ) {
-      printf( "Failed to load font! SDL_ttf Error: %s\n", TTF_GetError() );
-      return false;
-    }
+    // pictures baked by cars_bake, if available
+    if (!_bundle.open(data_path + "cars.bundle"))
+      printf("No asset bundle, decoding the PNG files. Run cars_bake to create it.\n");
+    // the pictures and sounds are decoded by the workers,
+    // the entities are set up once they are all loaded
+    AssetLoader loader(graphics_path, _bundle);
     // create scores
-    _score_textures.resize(_nplayers);
     _scores.resize(_nplayers);
-    //Open the time font
-    _time_font = TTF_OpenFont( (data_path + "fonts/LCD2U___.TTF").c_str(), 80 );
-    if( _time_font == NULL ) {
-      printf( "Failed to load font! SDL_ttf Error: %s\n", TTF_GetError() );
-      return false;
-    }
     _last_renderer_time = -1;
-    // load music and sounds
-    // WAVE, MOD, MIDI, OGG, MP3, FLAC
-    // sox cocoa_river.ogg -r 22050 cocoa_river.wav
-    _music = Mix_LoadMUS( (data_path + "music/cocoa_river.ogg").c_str() );
-    if( _music == NULL ) {
-      printf( "Failed to load music! SDL_mixer Error: %s\n", Mix_GetError() );
+    if (!_headless && !load_fonts_and_sounds(data_path, loader))
       return false;
-    }
-    if (! (_grab_collectable_sfx    = Mix_LoadWAV((data_path + "sounds/grab_collectable.ogg").c_str()))
-        || ! (_last_lap_fanfare_sfx = Mix_LoadWAV((data_path + "sounds/last_lap_fanfare.ogg").c_str()))
-        || ! (_pre_start_race_sfx   = Mix_LoadWAV((data_path + "sounds/pre_start_race.ogg").c_str()))
-        || ! (_race_finish_sfx      = Mix_LoadWAV((data_path + "sounds/race_finish.ogg").c_str()))
-        || ! (_start_race_sfx       = Mix_LoadWAV((data_path + "sounds/start_race.ogg").c_str()))
-        || ! (_track_intro_sfx      = Mix_LoadWAV((data_path + "sounds/track_intro.ogg").c_str()))
-        ) {
-      printf( "Failed to load music! SDL_mixer Error: %s\n", Mix_GetError() );
-      return false;
-    }
-    Mix_VolumeMusic(128);
-    Mix_PlayChannel( -1, _track_intro_sfx, 0 );
-    // init bubble manager
-    _bubble_tex.from_file(renderer, graphics_path + "bubble.png", 50);
-    _bubble_man.set_texture(&_bubble_tex);
-    for (unsigned int i = 0; i < 10; ++i)
-      _bubble_man.create_bubble(Point2d(rand()% _winw, rand() % _winh), .5);
-    // init candy
+    loader.add_texture(&_bubble_tex, "bubble.png", 50);
     _candy_textures.resize(3);
-    _candy_textures[0].from_file(renderer, graphics_path + "candy/chuche1.png", 100);
-    _candy_textures[1].from_file(renderer, graphics_path + "candy/chuche2.png", 50);
-    _candy_textures[2].from_file(renderer, graphics_path + "candy/huevo.png", 80);
-    std::vector<Texture*> candy_texture_ptrs;
-    for (unsigned int i = 0; i < _candy_textures.size(); ++i)
-      candy_texture_ptrs.push_back(&_candy_textures[i]);
-    _candy.set_textures(candy_texture_ptrs);
-    // init cars
+    int collision_minalpha = 80;
+    loader.add_texture(&_candy_textures[0], "candy/chuche1.png", 100, -1, -1, collision_minalpha);
+    loader.add_texture(&_candy_textures[1], "candy/chuche2.png", 50, -1, -1, collision_minalpha);
+    loader.add_texture(&_candy_textures[2], "candy/huevo.png", 80, -1, -1, collision_minalpha);
     unsigned int car_width = 200, cup_width = 64; // px
     _cup_textures.resize(3);
-    _cup_textures[0].from_file(renderer, graphics_path + "cup_gold.png", cup_width);
-    _cup_textures[1].from_file(renderer, graphics_path + "cup_silver.png", cup_width);
-    _cup_textures[2].from_file(renderer, graphics_path + "cup_bronze.png", cup_width);
+    loader.add_texture(&_cup_textures[0], "cup_gold.png", cup_width);
+    loader.add_texture(&_cup_textures[1], "cup_silver.png", cup_width);
+    loader.add_texture(&_cup_textures[2], "cup_bronze.png", cup_width);
     _car_textures.resize(3 * _nplayers);
-    _cars.resize(_nplayers);
+    _front_wheel_offsets.resize(_nplayers);
+    _back_wheel_offsets.resize(_nplayers);
+    _exhaust_pipe_offsets.resize(_nplayers);
     for (unsigned int i = 0; i < _nplayers; ++i) {
       Point2d fw, bw, e;
       std::string pname = player_names[i];
@@ -379,59 +361,243 @@ public:
         printf("Unknown car '%s'\n", pname.c_str());
         return false;
       }
-      std::ostringstream carfile;
-      carfile << graphics_path << "cars/" << pname;
-      bool ok = true;
-      ok = ok && _car_textures[3*i].from_file(renderer, carfile.str() + ".png", car_width);
-      ok = ok && _car_textures[3*i+1].from_file(renderer, carfile.str() + "_front_wheel.png",
-                                                -1, -1, _car_textures[3*i].get_resize_scale());
-      ok = ok && _car_textures[3*i+2].from_file(renderer, carfile.str() + "_back_wheel.png",
-                                                -1, -1, _car_textures[3*i].get_resize_scale());
-      ok = ok && _cars[i].set_textures(&_car_textures[3*i],
-          fw, &_car_textures[3*i+1], bw, &_car_textures[3*i+2], e);
-      if (!ok)
-        return false;
-      _cars[i].set_position(Point2d(200, (i+1) * winh / (_nplayers+1)));
+      _front_wheel_offsets[i] = fw;
+      _back_wheel_offsets[i] = bw;
+      _exhaust_pipe_offsets[i] = e;
+      // the wheels are scaled as the car, so loaded after it.
+      // Players of the same model share its pictures
+      std::string carfile = "cars/" + pname;
+      Texture* car = _resources.acquire_texture(loader, carfile + ".png", car_width,
+                                                -1, -1, collision_minalpha);
+      _car_textures[3*i] = car;
+      _car_textures[3*i+1] = _resources.acquire_texture
+          (loader, carfile + "_front_wheel.png", -1, -1, -1, 1, car);
+      _car_textures[3*i+2] = _resources.acquire_texture
+          (loader, carfile + "_back_wheel.png", -1, -1, -1, 1, car);
     }
-    // init fishes
     unsigned int nfish_textures = 8;
     _fish_textures.resize(nfish_textures);
     int fish_size = 100; // px
     for (unsigned int i = 0; i < nfish_textures; ++i) {
       std::ostringstream filename;
-      filename << graphics_path + "fish/pez"<< i+1 << ".png";
-      _fish_textures[i].from_file(renderer, filename.str(), fish_size);
+      filename << "fish/pez"<< i+1 << ".png";
+      loader.add_texture(&_fish_textures[i], filename.str(), fish_size);
+    }
+    if (!wait_for_assets(loader))
+      return false;
+    _resources.finish_loading();
+    size_t decoded_rss = resident_memory_bytes(), decoded_bytes = textures_bytes();
+    set_texture_modes(keep_surfaces ? TEXTURE_KEEP_SURFACE : TEXTURE_COLLISION,
+                      keep_surfaces ? TEXTURE_KEEP_SURFACE : TEXTURE_DRAW_ONLY);
+
+    _jobs.start(nthreads);
+    DEBUG_PRINT("Updating the entities on %i threads\n", _jobs.get_nthreads());
+    // init bubble manager
+    _bubble_man.set_texture(&_bubble_tex);
+    // a car emits a bubble per tick at most: the pool is never full
+    unsigned int nbubbles = 10;
+    _bubble_man.set_capacity(nbubbles + _bubble_man.max_alive(_nplayers, TICK_RATE, _winh));
+    for (unsigned int i = 0; i < nbubbles; ++i)
+      _bubble_man.create_bubble(Point2d(rand()% _winw, rand() % _winh), .5);
+    // init candy
+    _entities.clear();
+    _candies.resize(ncandies);
+    for (unsigned int i = 0; i < ncandies; ++i) {
+      _candies[i].create(_entities);
+      _candies[i].set_textures(_candy_textures);
     }
+    _candy_grid.resize(_winw, _winh, 128);
+    _candy_candidates.reserve(ncandies);
+    _arena.reserve(FRAME_ARENA_SIZE);
+    // init cars
+    _cars.resize(_nplayers);
+    for (unsigned int i = 0; i < _nplayers; ++i) {
+      if (!create_car(_cars[i], i))
+        return false;
+      _cars[i].set_position(Point2d(200, (i+1) * winh / (_nplayers+1)));
+      _cars[i].set_rand_seed(rand());
+    }
+    // init fishes
     _fishes.resize(nfishes);
     for (unsigned int var = 0; var < nfishes; ++var) {
       Fish* fish = &(_fishes[var]);
+      fish->create(_entities);
       fish->set_texture(&_fish_textures[rand()%nfish_textures]);
       fish->move_random_border(_winw, _winh);
     }
+    _entities.propagate(0); // place the wheels
+    // pack all the pictures together, to draw the sprites of a layer at once
+    if (!_headless) {
+      Timer timer;
+      std::vector<Texture*> textures;
+      get_textures(textures);
+      for (unsigned int i = 0; i < textures.size(); ++i)
+        _atlas.add(textures[i]);
+      // the digits of the scores and of the time, drawn without new textures
+      TextureMode glyph_mode = (keep_surfaces ? TEXTURE_KEEP_SURFACE : TEXTURE_DRAW_ONLY);
+      if (!_score_glyphs.build(_score_font, _atlas, glyph_mode)
+          || !_time_glyphs.build(_time_font, _atlas, glyph_mode))
+        return false;
+      if (!_atlas.build(renderer))
+        return false;
+      DEBUG_PRINT("Atlas: %i pages\n", _atlas.get_npages());
+      loader.add_timing("atlas packing and upload", 1000 * timer.getTimeSeconds());
+      play_sfx(_track_intro_sfx);
+    }
+    loader.print_report();
+    _resources.print_stats();
+    printf("Pictures: %.2f MB decoded, %.2f MB kept. Resident memory: %.1f MB decoded, %.1f MB ready\n",
+           decoded_bytes / (1024. * 1024.), textures_bytes() / (1024. * 1024.),
+           decoded_rss / (1024. * 1024.), resident_memory_bytes() / (1024. * 1024.));
     return true;
   } // end init()
 
   //////////////////////////////////////////////////////////////////////////////
 
+  /*! measure the time of update() and render() with more and more entities.
+   * For each size f of \arg sizes, the scene gets 15 f fishes, 100 f bubbles,
+   * f candies and f times as many cars as players, all driven by the computer,
+   * then \arg nframes frames are run as fast as possible during a race.
+   * A table of the times is printed, against the budgets of 60 and 120 Hz.
+   * \return false if update() or render() failed, e.g. when quitting
+   */
+  bool run_stress(const std::vector<unsigned int> & sizes, unsigned int nframes = 100) {
+    static const double BUDGET_60HZ = 1000. / 60, BUDGET_120HZ = 1000. / 120; // ms
+    unsigned int nmodels = _front_wheel_offsets.size(), nwarmup = 10;
+    _autopilot = true;
+    printf("Stress test: %i frames per size%s, frame budget %.2f ms at 60 Hz, %.2f ms at 120 Hz\n",
+           nframes, (_headless ? ", update only" : ""), BUDGET_60HZ, BUDGET_120HZ);
+    printf("  size fishes bubbles candies  cars |  update p50    p99 |  render p50    p99 |"
+           "  frame p99 | 60 Hz 120 Hz\n");
+    for (unsigned int s = 0; s < sizes.size(); ++s) {
+      unsigned int f = sizes[s], nbubbles = 100 * f;
+      set_stress_scene(15 * f, nbubbles, f, nmodels * f);
+      TimeHistogram update_ms, render_ms, frame_ms;
+      for (unsigned int frame = 0; frame < nwarmup + nframes; ++frame) {
+        _bubble_man.set_capacity(std::max(_bubble_man.capacity(), nbubbles));
+        while (_bubble_man.size() < nbubbles)
+          _bubble_man.create_bubble(Point2d(rand() % _winw, rand() % _winh), .2 + .5 * drand48());
+        Timer timer;
+        if (!update())
+          return false;
+        double update_time = 1000 * timer.getTimeSeconds();
+        timer.reset();
+        if (!_headless && !render())
+          return false;
+        double render_time = 1000 * timer.getTimeSeconds();
+        if (_headless)
+          _profiler.end_frame();
+        if (frame < nwarmup)
+          continue;
+        update_ms.add(update_time);
+        render_ms.add(render_time);
+        frame_ms.add(update_time + render_time);
+      } // end loop frame
+      double p99 = frame_ms.percentile(.99);
+      printf("  %4i %6i %7i %7i %5i | %11.3f %6.3f | ",
+             f, (int) _fishes.size(), nbubbles, (int) _candies.size(), _nplayers,
+             update_ms.percentile(.5), update_ms.percentile(.99));
+      if (_headless)
+        printf("%11s %6s | ", "-", "-");
+      else
+        printf("%11.3f %6.3f | ", render_ms.percentile(.5), render_ms.percentile(.99));
+      printf("%10.3f | %5s %6s\n", p99,
+             (p99 <= BUDGET_60HZ ? "ok" : "OVER"), (p99 <= BUDGET_120HZ ? "ok" : "OVER"));
+    } // end loop s
+    return true;
+  } // end run_stress()
+
+  //////////////////////////////////////////////////////////////////////////////
+
+  /*! what the pictures keep once uploaded: \arg collision_mode for the ones that collide,
+   * the cars and candies, \arg draw_mode for the others. Headless, nothing is uploaded:
+   * they are released at once.
+   */
+  void set_texture_modes(TextureMode collision_mode, TextureMode draw_mode) {
+    std::vector<Texture*> textures;
+    get_textures(textures);
+    for (unsigned int i = 0; i < textures.size(); ++i)
+      textures[i]->set_mode(draw_mode);
+    for (unsigned int i = 0; i < _candy_textures.size(); ++i)
+      _candy_textures[i].set_mode(collision_mode);
+    for (unsigned int i = 0; i < _car_textures.size(); i += 3) // bodies, not wheels
+      _car_textures[i]->set_mode(collision_mode);
+    if (_headless) {
+      for (unsigned int i = 0; i < textures.size(); ++i)
+        textures[i]->release_surface();
+    }
+  } // end set_texture_modes()
+
+  //! all the pictures of the game, each once, without the glyphs of the fonts
+  void get_textures(std::vector<Texture*> & textures) {
+    textures.clear();
+    textures.push_back(&_bubble_tex);
+    for (unsigned int i = 0; i < _candy_textures.size(); ++i)
+      textures.push_back(&_candy_textures[i]);
+    for (unsigned int i = 0; i < _cup_textures.size(); ++i)
+      textures.push_back(&_cup_textures[i]);
+    for (unsigned int i = 0; i < _car_textures.size(); ++i) { // each model once
+      if (std::find(textures.begin(), textures.end(), _car_textures[i]) == textures.end())
+        textures.push_back(_car_textures[i]);
+    }
+    for (unsigned int i = 0; i < _fish_textures.size(); ++i)
+      textures.push_back(&_fish_textures[i]);
+  }
+
+  //! the memory of the pictures of get_textures(), in bytes
+  size_t textures_bytes() {
+    std::vector<Texture*> textures;
+    get_textures(textures);
+    size_t bytes = 0;
+    for (unsigned int i = 0; i < textures.size(); ++i)
+      bytes += textures[i]->get_bytes();
+    return bytes;
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+
+  //! run one full race (countdown + race) as fast as possible, without display
+  bool run_headless_race() {
+    _game_status = GAME_STATUS_WAITING;
+    while (true) {
+      if (!update())
+        return false;
+      _profiler.end_frame();
+      if (_game_status == GAME_STATUS_RACE_OVER)
+        return true;
+    }
+  } // end run_headless_race()
+
+  //////////////////////////////////////////////////////////////////////////////
+
   bool clean() {
     DEBUG_PRINT("Game::clean()\n");
-    SDL_DestroyRenderer( renderer);
-    SDL_DestroyWindow( window );
+    _jobs.stop();
+    if (_bubble_man.ndropped() > 0)
+      printf("%u bubbles were dropped, the pool of %u was full\n",
+             _bubble_man.ndropped(), _bubble_man.capacity());
+    _atlas.free(); // the pages belong to the renderer
+    // the shared resources, before their libraries quit
+    for (unsigned int i = 0; i < _car_textures.size(); ++i)
+      _resources.release(_car_textures[i]);
+    _car_textures.clear();
+    Mix_Chunk** sfx[] = { &_grab_collectable_sfx, &_last_lap_fanfare_sfx, &_pre_start_race_sfx,
+                          &_race_finish_sfx, &_start_race_sfx, &_track_intro_sfx };
+    for (unsigned int i = 0; i < sizeof(sfx) / sizeof(sfx[0]); ++i) {
+      _resources.release(*sfx[i]);
+      *sfx[i] = NULL;
+    }
+    _resources.release(_score_font);
+    _resources.release(_time_font);
+    _score_font = _time_font = NULL;
+    if (renderer)
+      SDL_DestroyRenderer( renderer);
+    if (window)
+      SDL_DestroyWindow( window );
     //Stop the music
     if (_music)
       Mix_FreeMusic( _music );
     _music = NULL;
-    Mix_FreeChunk_safe(_grab_collectable_sfx);
-    Mix_FreeChunk_safe(_last_lap_fanfare_sfx);
-    Mix_FreeChunk_safe(_pre_start_race_sfx);
-    Mix_FreeChunk_safe(_race_finish_sfx);
-    Mix_FreeChunk_safe(_start_race_sfx);
-    Mix_FreeChunk_safe(_track_intro_sfx);
-    if (_score_font)
-      TTF_CloseFont( _score_font );
-    if (_time_font)
-      TTF_CloseFont( _time_font );
-    _score_font = _time_font = NULL;
     for (unsigned int i = 0; i < gameControllers.size(); ++i)
       SDL_JoystickClose( gameControllers[i] );
     //Quit SDL subsystems
@@ -442,173 +608,671 @@ public:
   }
   //////////////////////////////////////////////////////////////////////////////
 
+  /*! one tick of the simulation. The heap allocations during the tick,
+   * by all the threads, are counted in tick_allocs(),
+   * and in race_allocs() if it is a tick of the race itself.
+   */
   bool update() {
+    bool racing = (_game_status == GAME_STATUS_RACE);
+    AllocCount start = AllocCount::now();
+    _arena.reset(); // the data of the previous tick
+    bool ok = update_world();
+    AllocCount used = AllocCount::now() - start;
+    _tick_allocs.add(used);
+    if (racing && _game_status == GAME_STATUS_RACE)
+      _race_allocs.add(used);
+    return ok;
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+
+  bool update_world() {
     DEBUG_PRINT("Game::update()\n");
+    TraceScope trace("Game::update");
+    ProfileScope update_scope(_profiler, PROFILE_UPDATE);
+    _clock.tick();
     // check game status changes
+    _profiler.begin(PROFILE_STATUS);
     if (_game_status == GAME_STATUS_WAITING) {
       DEBUG_PRINT("Game status: WAITING->COUNTDOWN()\n");
       _game_status = GAME_STATUS_COUNTDOWN;
-      _game_timer.reset();
-      _candy.move_far_away();
-      Mix_HaltMusic();
+      _status_start_time = _clock.now();
+      for (unsigned int i = 0; i < _candies.size(); ++i)
+        _candies[i].move_far_away();
+      halt_music();
       // reset ranks and scores
       for (unsigned int i = 0; i < _nplayers; ++i) {
         _cars[i].rank = -1;
         _scores[i] = 0;
-        if (!_score_textures[i].loadFromRenderedText(renderer, _score_font, "0", 255, 0, 0))
-          return false;
       }
-      _time_texture.loadFromRenderedText(renderer, _time_font, "0", 255, 0, 0);
     }
     else if (_game_status == GAME_STATUS_COUNTDOWN) {
-      if (_game_timer.getTimeSeconds() >= COUNTDOWN_LENGTH) {
+      if (status_time() >= COUNTDOWN_LENGTH) {
         DEBUG_PRINT("Game status: COUNTODWNG->RACE()\n");
         _game_status = GAME_STATUS_RACE;
-        _game_timer.reset();
+        _status_start_time = _clock.now();
         //Play the music
-        Mix_PlayChannel( -1, _start_race_sfx, 0 );
-        Mix_PlayMusic( _music, -1 );
+        play_sfx(_start_race_sfx);
+        if (!_headless)
+          Mix_PlayMusic( _music, -1 );
       }
     }
     else if (_game_status == GAME_STATUS_RACE) {
-      if (_game_timer.getTimeSeconds() >= GAME_LENGTH) {
+      if (status_time() >= GAME_LENGTH) {
         DEBUG_PRINT("Game status: RACE->RACE_OVER()\n");
         _game_status = GAME_STATUS_RACE_OVER;
-        _candy.move_far_away();
-        Mix_HaltMusic();
-        Mix_PlayChannel( -1, _race_finish_sfx, 0 );
+        for (unsigned int i = 0; i < _candies.size(); ++i)
+          _candies[i].move_far_away();
+        halt_music();
+        play_sfx(_race_finish_sfx);
         podium();
       }
     }
+    _profiler.end(PROFILE_STATUS);
     // update all subcomponents
-    for (unsigned int i = 0; i < _nplayers; ++i)
-      _cars[i].update(_winw, _winh, &_bubble_man);
-    for (unsigned int i = 0; i < _fishes.size(); ++i)
-      _fishes[i].update(_winw, _winh);
-    if (_game_status ==  GAME_STATUS_RACE && !_candy.update(_winw, _winh, _cars))
-      return false;
-    _bubble_man.update(_winw, _winh);
-    // check candy touched by car
-    if (_game_status == GAME_STATUS_RACE) {
-      for (unsigned int i = 0; i < _nplayers; ++i) {
-        if (!_cars[i].collides_with(_candy, 80))
-          continue;
-        DEBUG_PRINT("Car %i got a candy at time %g!\n", i, _candy.get_life_timer());
-        Mix_PlayChannel( -1, _grab_collectable_sfx, 0 );
-        ++_scores[i];
-        std::ostringstream score;
-        score << _scores[i];
-        if (!_score_textures[i].loadFromRenderedText(renderer, _score_font, score.str(), 255, 0, 0))
-          return false;
-        if (!_candy.respawn(_winw, _winh, _cars))
+    // the entities are updated in parallel chunks, then what needs rand()
+    // or the bubble pool is done in the order of the entities
+    _profiler.begin(PROFILE_CARS);
+    unsigned int ncar_chunks = JobSystem::nchunks(_nplayers, CARS_CHUNK_SIZE);
+    if (_car_bubbles.size() < ncar_chunks) {
+      _car_bubbles.resize(ncar_chunks);
+      for (unsigned int c = 0; c < ncar_chunks; ++c)
+        _car_bubbles[c].reserve(CARS_CHUNK_SIZE); // a bubble per car at most
+    }
+    CarsJob cars_job(this);
+    _jobs.parallel_for(cars_job, _nplayers, CARS_CHUNK_SIZE);
+    for (unsigned int c = 0; c < ncar_chunks; ++c) {
+      _bubble_man.create_bubbles(_car_bubbles[c]);
+      _car_bubbles[c].clear();
+    }
+    _profiler.end(PROFILE_CARS);
+    _profiler.begin(PROFILE_FISHES);
+    if (_fish_visible.size() != _fishes.size())
+      _fish_visible.resize(_fishes.size());
+    FishesJob fishes_job(this);
+    _jobs.parallel_for(fishes_job, _fishes.size(), FISHES_CHUNK_SIZE);
+    for (unsigned int i = 0; i < _fishes.size(); ++i) {
+      if (!_fish_visible[i])
+        _fishes[i].respawn(_clock, _winw, _winh);
+    }
+    _profiler.end(PROFILE_FISHES);
+    {
+      ProfileScope scope(_profiler, PROFILE_CANDIES);
+      for (unsigned int i = 0; i < _candies.size(); ++i) {
+        if (_game_status ==  GAME_STATUS_RACE && !_candies[i].update(_clock, _winw, _winh, _cars))
           return false;
       }
     }
+    _profiler.begin(PROFILE_BUBBLES);
+    _bubble_man.update(_clock, _winw, _winh, &_jobs);
+    _profiler.end(PROFILE_BUBBLES);
+    _profiler.begin(PROFILE_TRANSFORMS);
+    _entities.propagate(_clock.dt()); // the wheels follow their cars
+    _profiler.end(PROFILE_TRANSFORMS);
+    // check candies touched by cars: only test the candies near each car
+    if (_game_status == GAME_STATUS_RACE) {
+      ProfileScope scope(_profiler, PROFILE_COLLISIONS);
+      _candy_grid.clear(_arena, _candies.size());
+      for (unsigned int j = 0; j < _candies.size(); ++j) {
+        Point2d pos = _candies[j].get_position();
+        _candy_grid.insert(j, pos.x, pos.y, _candies[j].get_entity_radius());
+      }
+      for (unsigned int i = 0; i < _nplayers; ++i) {
+        Point2d pos = _cars[i].get_position();
+        _candy_grid.query(pos.x, pos.y, _cars[i].get_entity_radius(), _candy_candidates);
+        for (unsigned int k = 0; k < _candy_candidates.size(); ++k) {
+          Candy & candy = _candies[_candy_candidates[k]];
+          if (!_cars[i].collides_with(candy))
+            continue;
+          DEBUG_PRINT("Car %i got a candy after %g s!\n", i, candy.get_time_since_spawn(_clock));
+          play_sfx(_grab_collectable_sfx);
+          ++_scores[i];
+          if (!candy.respawn(_clock, _winw, _winh, _cars))
+            return false;
+        } // end loop k
+      } // end loop i
+    }
+    if (_headless) // no window, hence no events
+      return true;
 
     // update with events
+    ProfileScope events_scope(_profiler, PROFILE_EVENTS);
+    if (_threaded) { // the events polled by the rendering thread
+      SDL_LockMutex(_events_mutex);
+      _sim_events.swap(_events);
+      SDL_UnlockMutex(_events_mutex);
+      bool ok = true;
+      for (unsigned int i = 0; i < _sim_events.size(); ++i)
+        ok = handle_event(_sim_events[i]) && ok;
+      _sim_events.clear();
+      return ok;
+    }
     SDL_Event event;
     while ( SDL_PollEvent( &event ) ) {
-      if ( event.type == SDL_QUIT )
+      if (!handle_event(event))
         return false;
-      else if ( event.type == SDL_KEYDOWN ) {
-        SDL_Keycode key = event.key.keysym.sym;
-        if (key == SDLK_q)
-          return false;
-        else if (key == SDLK_r)
-          _game_status = GAME_STATUS_WAITING;
-        else if ((key == SDLK_UP || key == SDLK_DOWN) && !_cars.empty()) {
-          _cars.back().set_accel(Point2d());
-          _cars.back().set_speed(Point2d());
-          _cars.back().advance( (key == SDLK_UP ? 10 : -10));
-        }
-        else if ((key == SDLK_LEFT || key == SDLK_RIGHT) && !_cars.empty()) {
-          _cars.back().set_accel(Point2d());
-          _cars.back().set_speed(Point2d());
-          _cars.back().increase_angle( (key == SDLK_LEFT ? .1 : -.1));
-        }
-      } // end SDL_KEYDOWN
-      else if( event.type == SDL_JOYAXISMOTION ) {
-        //Motion on controller 0
-        if( event.jaxis.which <= (int) _nplayers ) {
-          Car* car = &(_cars[event.jaxis.which]);
-#if 1 // control car accelerations
-          Point2d accel = car->get_accel();
-          if( event.jaxis.axis == 0 ) // X axis motion
-            car->set_accel(Point2d(event.jaxis.value / 50, accel.y));
-          else if( event.jaxis.axis == 1)
-            car->set_accel(Point2d(accel.x, event.jaxis.value / 50));
-#else // control car speeds
-          Point2d speed = car->get_speed();
-          if( event.jaxis.axis == 0 ) // X axis motion
-            car->set_speed(Point2d(event.jaxis.value / 50, speed.y));
-          else if( event.jaxis.axis == 1)
-            car->set_speed(Point2d(speed.x, event.jaxis.value / 50));
-#endif
-        }
-      } // end SDL_JOYAXISMOTION
-    } // end while ( SDL_PollEvent( &event ) )
+    }
     return true;
   }
 
   //////////////////////////////////////////////////////////////////////////////
 
-  bool render() {
-    SDL_RenderClear( renderer );
-    DEBUG_PRINT("Game::render()\n");
-    bool ok = _candy.render(renderer);
+  //! fill \arg snap with what render() draws of the world
+  void make_snapshot(WorldSnapshot & snap) const {
+    snap.clear();
+    snap.tick = _clock.ticks();
+    for (unsigned int i = 0; i < _candies.size(); ++i)
+      WorldSnapshot::add(snap.candies, _candies[i], i);
     for (unsigned int i = 0; i < _nplayers; ++i) {
-      ok  = ok && _cars[i].render(renderer);
-      // rander rank cup if needed
+      WorldSnapshot::add(snap.cars, _cars[i], i);
+      // rank cup above the car if needed
       int rank = _cars[i].rank;
-      if (rank < 0 || rank >= 3)
-        continue;
-      Point2d pos = _cars[i].get_position() + Point2d(0, -_cars[i].get_entity_radius());
-      _cup_textures[rank].render_center(renderer, pos);
+      if (rank >= 0 && rank < 3) {
+        SpriteState cup;
+        cup.tex = &_cup_textures[rank];
+        cup.position = _cars[i].get_position() + Point2d(0, -_cars[i].get_entity_radius());
+        cup.angle = 0;
+        cup.scale = 1;
+        cup.id = i;
+        snap.cars.push_back(cup);
+      }
+      PlayerState player;
+      player.car = _cars[i].get_texture();
+      player.score = _scores[i];
+      player.rank = rank;
+      snap.players.push_back(player);
+    } // end loop i
+    for (unsigned int i = 0; i < _fishes.size(); ++i)
+      WorldSnapshot::add(snap.fishes, _fishes[i], i);
+    for (unsigned int i = 0; i < _bubble_man.size(); ++i) {
+      SpriteState bubble;
+      bubble.tex = &_bubble_tex;
+      bubble.position = _bubble_man.get_position(i);
+      bubble.angle = 0;
+      bubble.scale = _bubble_man.get_scale(i);
+      bubble.id = _bubble_man.get_id(i);
+      snap.bubbles.push_back(bubble);
     }
+#if DEBUG
+    for (unsigned int i = 0; i < _candies.size(); ++i)
+      WorldSnapshot::add(snap.debug, _candies[i]);
+    for (unsigned int i = 0; i < _nplayers; ++i)
+      WorldSnapshot::add(snap.debug, _cars[i]);
     for (unsigned int i = 0; i < _fishes.size(); ++i)
-      ok  = ok && _fishes[i].render(renderer);
-    ok  = ok && _bubble_man.render(renderer);
-    // render scores
+      WorldSnapshot::add(snap.debug, _fishes[i]);
+#endif // DEBUG
+    snap.status = _game_status;
+    snap.hud_time = -1;
+    if (_game_status == GAME_STATUS_COUNTDOWN)
+      snap.hud_time = COUNTDOWN_LENGTH + 1 - status_time();
+    else if (_game_status == GAME_STATUS_RACE)
+      snap.hud_time = GAME_LENGTH + 1 - status_time();
+  } // end make_snapshot()
+
+  //////////////////////////////////////////////////////////////////////////////
+
+  //! draw the current state of the world, in the calling thread
+  bool render() {
+    {
+      ProfileScope scope(_profiler, PROFILE_SNAPSHOT);
+      make_snapshot(_snapshot);
+    }
+    bool ok = draw(_snapshot, _snapshot, 1);
+    _profiler.end_frame();
+    return ok;
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+
+  /*! run the game until quitting. The simulation ticks at TICK_RATE
+   * in its own thread, and publishes a snapshot of the world after each tick.
+   * The calling thread handles the events, and draws the latest snapshot
+   * at the refresh rate of the display, interpolated from the previous one:
+   * the display then lags one tick behind the simulation.
+   * \return false if the simulation or the rendering failed
+   */
+  bool run_threaded(bool vsync) {
+    int refresh_hz = 60;
+    SDL_DisplayMode mode;
+    if (SDL_GetWindowDisplayMode(window, &mode) == 0 && mode.refresh_rate > 0)
+      refresh_hz = mode.refresh_rate;
+    _events_mutex = SDL_CreateMutex();
+    _threaded = true;
+    _sim_ok = true;
+    SDL_AtomicSet(&_running, 1);
+    make_snapshot(_snapshots.back());
+    _snapshots.publish();
+    SDL_Thread* simulation = SDL_CreateThread(simulate, "simulation", this);
+    if (simulation == NULL) {
+      printf("Could not create the simulation thread: '%s'\n", SDL_GetError());
+      SDL_DestroyMutex(_events_mutex);
+      _threaded = false;
+      return false;
+    }
+    DEBUG_PRINT("Simulating at %i Hz, rendering at %i Hz\n", TICK_RATE, refresh_hz);
+    FramePacer pacer(refresh_hz, vsync);
+    AllocMeter frame_allocs; // of the process, the simulation included
+    bool ok = true;
+    while (ok && SDL_AtomicGet(&_running)) {
+      // quit and profiler keys are handled here, the others by the simulation
+      SDL_Event event;
+      while ( SDL_PollEvent( &event ) ) {
+        if (event.type == SDL_KEYDOWN && event.key.keysym.sym != SDLK_q
+            && event.key.keysym.sym != SDLK_p) {
+          SDL_LockMutex(_events_mutex);
+          _events.push_back(event);
+          SDL_UnlockMutex(_events_mutex);
+        }
+        else if (event.type == SDL_JOYAXISMOTION) {
+          SDL_LockMutex(_events_mutex);
+          _events.push_back(event);
+          SDL_UnlockMutex(_events_mutex);
+        }
+        else if (!handle_event(event))
+          SDL_AtomicSet(&_running, 0);
+      } // end while ( SDL_PollEvent( &event ) )
+      _snapshots.acquire();
+      const WorldSnapshot & snap = _snapshots.latest();
+      double alpha = (monotonic_seconds() - snap.publish_time) * TICK_RATE;
+      AllocCount start = AllocCount::now();
+      ok = draw(_snapshots.previous(), snap, std::min(1., alpha));
+      frame_allocs.add(AllocCount::now() - start);
+      _profiler.end_frame();
+      if (!ok)
+        printf("Game::draw() failed!\n");
+      pacer.wait(); // with vsync, SDL_RenderPresent() waited: only measures the frame
+    } // end while (running)
+    SDL_AtomicSet(&_running, 0);
+    SDL_WaitThread(simulation, NULL);
+    SDL_DestroyMutex(_events_mutex);
+    _threaded = false;
+    pacer.print_stats("Display pacing");
+    frame_allocs.print_stats("Allocations of the displayed frames");
+    _tick_allocs.print_stats("Allocations of the ticks");
+    return ok && _sim_ok;
+  } // end run_threaded()
+
+  //////////////////////////////////////////////////////////////////////////////
+
+  inline FrameProfiler & profiler() { return _profiler; }
+  //! the allocations of all the ticks, and of the ticks of the races
+  inline const AllocMeter & tick_allocs() const { return _tick_allocs; }
+  inline const AllocMeter & race_allocs() const { return _race_allocs; }
+
+  //////////////////////////////////////////////////////////////////////////////
+
+  //! a hash of the scores and of the positions of the cars,
+  //! to check that two runs with the same seed are identical
+  unsigned long checksum() const {
+    unsigned long hash = 5381;
     for (unsigned int i = 0; i < _nplayers; ++i) {
-      int cell = _winw / (_nplayers+1), x = cell * (i+1);
-      ok = ok && _cars[i].get_texture()->render_center(renderer, Point2d(x, 30), .5);
-      ok = ok && _score_textures[i].render_center(renderer, Point2d(x, 70));
-      int rank = _cars[i].rank; // render rank cup if needed
-      if (rank >= 0 && rank < 3)
-        ok = ok && _cup_textures[rank].render_center(renderer, Point2d(x - 30, 70), .5);
+      Point2d pos = _cars[i].get_position();
+      hash = hash * 33 + _scores[i];
+      const unsigned char* bytes = (const unsigned char*) &pos;
+      for (unsigned int b = 0; b < sizeof(pos); ++b)
+        hash = hash * 33 + bytes[b];
+    }
+    return hash;
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  //////////////////////////////////////////////////////////////////////////////
+
+protected:
+  //! create the window and the renderer, open audio, fonts and joysticks
+  bool init_display_and_audio(bool vsync) {
+    //Initialize SDL_mixer
+    if( Mix_OpenAudio( 44100, MIX_DEFAULT_FORMAT, 2, 2048 ) < 0 ) {
+      printf( "SDL_mixer could not initialize! SDL_mixer Error: %s\n", Mix_GetError() );
+      return false;
+    }
+    //Initialize SDL_ttf
+    if( TTF_Init() == -1 ) {
+      printf( "SDL_ttf could not initialize! SDL_ttf Error: %s\n", TTF_GetError() );
+      return false;
+    }
+    // create window
+    SDL_Rect windowRect = { 10, 10, _winw, _winh};
+    window = SDL_CreateWindow( "cars", windowRect.x, windowRect.y, _winw, _winh, 0 );
+    if ( window == NULL ) {
+      std::cout << "Failed to create window : " << SDL_GetError();
+      return false;
+    }
+    // create renderer
+    renderer = SDL_CreateRenderer( window, -1, (vsync ? SDL_RENDERER_PRESENTVSYNC : 0) );
+    if ( renderer == NULL ) {
+      std::cout << "Failed to create renderer : " << SDL_GetError();
+      return false;
+    }
+    // Set size of renderer to the same as window
+    SDL_RenderSetLogicalSize( renderer, _winw, _winh );
+    // Set color of renderer to light blue
+    SDL_SetRenderDrawColor( renderer, 150, 150, 255, 255 );
+    //Check for joysticks
+    gameControllers.resize(SDL_NumJoysticks());
+    for (int i = 0; i < SDL_NumJoysticks(); ++i) {
+      gameControllers[i] = SDL_JoystickOpen( i );
+      if(gameControllers[i] == NULL )
+        printf( "Warning: Unable to open game controller! SDL Error: %s\n", SDL_GetError() );
+      else
+        DEBUG_PRINT( "Joystick %i connected\n", i);
+    }
+    return true;
+  } // end init_display_and_audio()
+
+  //! load fonts and music, and queue the sounds in \arg loader
+  bool load_fonts_and_sounds(const std::string & data_path, AssetLoader & loader) {
+    Timer timer;
+    //Open the score and time fonts, from the same file
+    _score_font = _resources.acquire_font(data_path + "fonts/LCD2U___.TTF", 40);
+    _time_font = _resources.acquire_font(data_path + "fonts/LCD2U___.TTF", 80);
+    if (_score_font == NULL || _time_font == NULL)
+      return false;
+    loader.add_timing("fonts", 1000 * timer.getTimeSeconds());
+    timer.reset();
+    // load music and sounds
+    // WAVE, MOD, MIDI, OGG, MP3, FLAC
+    // sox cocoa_river.ogg -r 22050 cocoa_river.wav
+    _music = Mix_LoadMUS( (data_path + "music/cocoa_river.ogg").c_str() );
+    if( _music == NULL ) {
+      printf( "Failed to load music! SDL_mixer Error: %s\n", Mix_GetError() );
+      return false;
+    }
+    loader.add_timing("music", 1000 * timer.getTimeSeconds());
+    // the sounds are fully decoded: leave them to the workers
+    _resources.acquire_sound(loader, data_path + "sounds/grab_collectable.ogg", &_grab_collectable_sfx);
+    _resources.acquire_sound(loader, data_path + "sounds/last_lap_fanfare.ogg", &_last_lap_fanfare_sfx);
+    _resources.acquire_sound(loader, data_path + "sounds/pre_start_race.ogg",   &_pre_start_race_sfx);
+    _resources.acquire_sound(loader, data_path + "sounds/race_finish.ogg",      &_race_finish_sfx);
+    _resources.acquire_sound(loader, data_path + "sounds/start_race.ogg",       &_start_race_sfx);
+    _resources.acquire_sound(loader, data_path + "sounds/track_intro.ogg",      &_track_intro_sfx);
+    Mix_VolumeMusic(128);
+    return true;
+  } // end load_fonts_and_sounds()
+
+  /*! run the loader on all the cores, while showing its progress.
+   * \return false if an asset could not be loaded
+   */
+  bool wait_for_assets(AssetLoader & loader) {
+    ThreadPool pool;
+    loader.start(pool);
+    unsigned int nfinished = 0;
+    while (nfinished < loader.size()) {
+      nfinished = loader.wait(20); // ms
+      if (!_headless)
+        render_loading(1. * nfinished / loader.size());
+    }
+    pool.wait();
+    return loader.ok();
+  }
+
+  void init_profiler() {
+    if (_profiler.nsections() > 0)
+      return;
+    _show_profiler = false;
+    _profiler.add_section("update");
+    _profiler.add_section("status", 1);
+    _profiler.add_section("cars", 1);
+    _profiler.add_section("fishes", 1);
+    _profiler.add_section("candies", 1);
+    _profiler.add_section("bubbles", 1);
+    _profiler.add_section("transforms", 1);
+    _profiler.add_section("collisions", 1);
+    _profiler.add_section("events", 1);
+    _profiler.add_section("snapshot");
+    _profiler.add_section("render");
+    _profiler.add_section("entities", 1);
+    _profiler.add_section("hud", 1);
+    _profiler.add_section("present", 1);
+  }
+
+  //! apply an event to the game, \return false if it asks to quit
+  bool handle_event(const SDL_Event & event) {
+    if ( event.type == SDL_QUIT )
+      return false;
+    else if ( event.type == SDL_KEYDOWN ) {
+      SDL_Keycode key = event.key.keysym.sym;
+      if (key == SDLK_q)
+        return false;
+      else if (key == SDLK_r)
+        _game_status = GAME_STATUS_WAITING;
+      else if (key == SDLK_p)
+        _show_profiler = !_show_profiler;
+      else if ((key == SDLK_UP || key == SDLK_DOWN) && !_cars.empty()) {
+        _cars.back().set_accel(Point2d());
+        _cars.back().set_speed(Point2d());
+        _cars.back().advance( (key == SDLK_UP ? 10 : -10));
+      }
+      else if ((key == SDLK_LEFT || key == SDLK_RIGHT) && !_cars.empty()) {
+        _cars.back().set_accel(Point2d());
+        _cars.back().set_speed(Point2d());
+        _cars.back().increase_angle( (key == SDLK_LEFT ? .1 : -.1));
+      }
+    } // end SDL_KEYDOWN
+    else if( event.type == SDL_JOYAXISMOTION ) {
+      //Motion on controller 0
+      if( event.jaxis.which <= (int) _nplayers ) {
+        Car* car = &(_cars[event.jaxis.which]);
+#if 1 // control car accelerations
+        Point2d accel = car->get_accel();
+        if( event.jaxis.axis == 0 ) // X axis motion
+          car->set_accel(Point2d(event.jaxis.value / 50, accel.y));
+        else if( event.jaxis.axis == 1)
+          car->set_accel(Point2d(accel.x, event.jaxis.value / 50));
+#else // control car speeds
+        Point2d speed = car->get_speed();
+        if( event.jaxis.axis == 0 ) // X axis motion
+          car->set_speed(Point2d(event.jaxis.value / 50, speed.y));
+        else if( event.jaxis.axis == 1)
+          car->set_speed(Point2d(speed.x, event.jaxis.value / 50));
+#endif
+      }
+    } // end SDL_JOYAXISMOTION
+    return true;
+  } // end handle_event()
+
+  /*! draw the world between the snapshots \arg prev and \arg snap,
+   * at \arg alpha in [0, 1] of the way from the first to the second.
+   */
+  bool draw(const WorldSnapshot & prev, const WorldSnapshot & snap, double alpha) {
+    TraceScope trace("Game::draw");
+    _profiler.begin(PROFILE_RENDER);
+    _profiler.begin(PROFILE_ENTITIES);
+    SDL_RenderClear( renderer );
+    DEBUG_PRINT("Game::draw()\n");
+    // each layer is drawn with one call per texture,
+    // but the cars, that cover each other in their order
+    WorldSnapshot::add(_batch, prev.candies, snap.candies, alpha);
+    bool ok = _batch.flush(renderer);
+    for (unsigned int i = 0; i < snap.cars.size(); ++i) {
+      SpriteState s = WorldSnapshot::interpolate(prev.cars, snap.cars, i, alpha);
+      ok = s.tex->render_center(renderer, s.position, s.scale, NULL, s.angle) && ok;
+    }
+    WorldSnapshot::add(_batch, prev.fishes, snap.fishes, alpha);
+    ok = _batch.flush(renderer) && ok;
+    WorldSnapshot::add(_batch, prev.bubbles, snap.bubbles, alpha);
+    ok = _batch.flush(renderer) && ok;
+#if DEBUG
+    ok = WorldSnapshot::render(renderer, snap.debug) && ok;
+#endif // DEBUG
+    _profiler.end(PROFILE_ENTITIES);
+    _profiler.begin(PROFILE_HUD);
+    // render scores
+    SDL_Color red = {255, 0, 0, 255}, white = {255, 255, 255, 255};
+    unsigned int nplayers = snap.players.size();
+    for (unsigned int i = 0; i < nplayers; ++i) {
+      const PlayerState & player = snap.players[i];
+      int cell = _winw / (nplayers+1), x = cell * (i+1);
+      _batch.add(*player.car, Point2d(x, 30), .5);
+      _score_glyphs.add_number(_batch, player.score, Point2d(x, 70), red);
+      if (player.rank >= 0 && player.rank < 3) // render rank cup if needed
+        _batch.add(_cup_textures[player.rank], Point2d(x - 30, 70), .5);
     }
     // render time
     // refresh time if needed
-    if (_game_status == GAME_STATUS_COUNTDOWN) {
-      int time = COUNTDOWN_LENGTH + 1 -_game_timer.getTimeSeconds();
+    if (snap.status == GAME_STATUS_COUNTDOWN) {
+      int time = snap.hud_time;
       if (time <= 3 && time != _last_renderer_time)
-        Mix_PlayChannel( -1, _pre_start_race_sfx, 0 );
-      ok = ok && render_time(time, 255, 0, 0)
-           && _time_texture.render_center(renderer, Point2d(50, 50),1);
+        play_sfx(_pre_start_race_sfx);
+      _last_renderer_time = time;
+      _time_glyphs.add_number(_batch, time, Point2d(50, 50), red);
     } // end if GAME_STATUS_COUNTDOWN
-    else if (_game_status == GAME_STATUS_RACE) {
-      int time = GAME_LENGTH + 1 - _game_timer.getTimeSeconds();
+    else if (snap.status == GAME_STATUS_RACE) {
+      int time = snap.hud_time;
       if (time == 9 && _last_renderer_time == 10) // 10 last seconds sfx
-        Mix_PlayChannel( -1, _last_lap_fanfare_sfx, 0 ); // last seconds
+        play_sfx(_last_lap_fanfare_sfx); // last seconds
       else if (time <= 5 && time != _last_renderer_time)
-        Mix_PlayChannel( -1, _pre_start_race_sfx, 0 );
-      ok = ok && render_time(time, 255, 255, 255)
-           && _time_texture.render_center(renderer, Point2d(50, 50),1);
+        play_sfx(_pre_start_race_sfx);
+      _last_renderer_time = time;
+      _time_glyphs.add_number(_batch, time, Point2d(50, 50), white);
     } // end if GAME_STATUS_RACE
+    ok = _batch.flush(renderer) && ok;
+    if (_show_profiler)
+      ok = _profiler.render(renderer, _batch, _score_glyphs, _winw - 350, 100,
+                            1000. / TICK_RATE) && ok;
+    _profiler.end(PROFILE_HUD);
     DEBUG_PRINT("render finished()\n");
+    _profiler.begin(PROFILE_PRESENT);
     SDL_RenderPresent( renderer);
+    _profiler.end(PROFILE_PRESENT);
+    _profiler.end(PROFILE_RENDER);
     return ok;
+  } // end draw()
+
+  //! the simulation thread of run_threaded(): tick, then publish a snapshot
+  static int simulate(void* data) {
+    Game & game = *((Game*) data);
+    FramePacer pacer(TICK_RATE);
+    while (SDL_AtomicGet(&game._running)) {
+      unsigned int nticks = pacer.wait();
+      for (unsigned int tick = 0; tick < nticks; ++tick) {
+        if (game.update())
+          continue;
+        printf("game.update() failed!\n");
+        game._sim_ok = false;
+        SDL_AtomicSet(&game._running, 0);
+        return -1;
+      } // end loop tick
+      ProfileScope scope(game._profiler, PROFILE_SNAPSHOT);
+      game.make_snapshot(game._snapshots.back());
+      game._snapshots.publish();
+    } // end while (running)
+    pacer.print_stats("Simulation pacing");
+    return 0;
   }
 
-  //////////////////////////////////////////////////////////////////////////////
-  //////////////////////////////////////////////////////////////////////////////
+  //! a progress bar in the middle of the window
+  void render_loading(double progress) {
+    Uint8 r, g, b, a; // the clear color of the game
+    SDL_GetRenderDrawColor( renderer, &r, &g, &b, &a );
+    SDL_SetRenderDrawColor( renderer, 0, 0, 0, 255 );
+    SDL_RenderClear( renderer );
+    SDL_Rect bar = { _winw / 4, _winh / 2 - 10, _winw / 2, 20 };
+    SDL_SetRenderDrawColor( renderer, 255, 255, 255, 255 );
+    SDL_RenderDrawRect( renderer, &bar );
+    bar.w = progress * bar.w;
+    SDL_RenderFillRect( renderer, &bar );
+    SDL_RenderPresent( renderer );
+    SDL_SetRenderDrawColor( renderer, r, g, b, a );
+  }
+
+  inline void play_sfx(Mix_Chunk* chunk) {
+    if (!_headless)
+      Mix_PlayChannel( -1, chunk, 0 );
+  }
+  inline void halt_music() {
+    if (!_headless)
+      Mix_HaltMusic();
+  }
+
+  //! \pre at least one candy
+  Candy & nearest_candy(const Point2d & pos) {
+    unsigned int best = 0;
+    for (unsigned int i = 1; i < _candies.size(); ++i) {
+      if ((_candies[i].get_position() - pos).norm() < (_candies[best].get_position() - pos).norm())
+        best = i;
+    }
+    return _candies[best];
+  }
+
+  static const unsigned int CARS_CHUNK_SIZE = 8, FISHES_CHUNK_SIZE = 64;
+
+  //! update a chunk of cars, their bubbles go in the buffer of the chunk
+  class CarsJob : public RangeJob {
+  public:
+    CarsJob(Game* game_) : game(*game_) {}
+    void run(unsigned int begin, unsigned int end, unsigned int chunk) {
+      bool steer = (game._autopilot && game._game_status == GAME_STATUS_RACE);
+      for (unsigned int i = begin; i < end; ++i) {
+        Car & car = game._cars[i];
+        if (steer)
+          car.steer_towards(game.nearest_candy(car.get_position()).get_position());
+        car.update(game._clock, game._winw, game._winh, game._car_bubbles[chunk]);
+      } // end loop i
+    }
+    Game & game;
+  }; // end class CarsJob
+
+  //! update a chunk of fishes, the ones out of the window are marked
+  class FishesJob : public RangeJob {
+  public:
+    FishesJob(Game* game_) : game(*game_) {}
+    void run(unsigned int begin, unsigned int end, unsigned int) {
+      for (unsigned int i = begin; i < end; ++i)
+        game._fish_visible[i] = game._fishes[i].update(game._clock, game._winw, game._winh);
+    }
+    Game & game;
+  }; // end class FishesJob
+
+  /*! rebuild the scene of run_stress() and start a race.
+   * The cars are made from the models of the players, in turn.
+   */
+  void set_stress_scene(unsigned int nfishes, unsigned int nbubbles,
+                        unsigned int ncandies, unsigned int ncars) {
+    _entities.clear();
+    _entities.reserve(nfishes + ncandies + 3 * ncars);
+    _fishes.resize(nfishes);
+    for (unsigned int i = 0; i < nfishes; ++i) {
+      _fishes[i].create(_entities);
+      _fishes[i].set_texture(&_fish_textures[rand() % _fish_textures.size()]);
+      _fishes[i].move_random_border(_winw, _winh);
+    }
+    _bubble_man.clear();
+    _bubble_man.set_capacity(std::max(_bubble_man.capacity(),
+                                      nbubbles + _bubble_man.max_alive(ncars, TICK_RATE, _winh)));
+    _candies.resize(ncandies);
+    for (unsigned int i = 0; i < ncandies; ++i) {
+      _candies[i].create(_entities);
+      _candies[i].set_textures(_candy_textures);
+      _candies[i].set_position(Point2d()); // respawned at the first update
+    }
+    _nplayers = ncars;
+    _cars.resize(ncars);
+    _scores.assign(ncars, 0);
+    for (unsigned int i = 0; i < ncars; ++i) {
+      _cars[i] = Car();
+      create_car(_cars[i], i % _front_wheel_offsets.size());
+      _cars[i].set_rand_seed(rand());
+      _cars[i].set_position(Point2d(rand() % _winw, rand() % _winh));
+    }
+    _entities.propagate(0);
+    _game_status = GAME_STATUS_RACE;
+    _status_start_time = _clock.now();
+  } // end set_stress_scene()
+
+  //! give \arg car a new entity, with the textures of the car of player \arg model
+  bool create_car(Car & car, unsigned int model) {
+    car.create(_entities);
+    return car.set_textures(_car_textures[3*model], _front_wheel_offsets[model],
+                            _car_textures[3*model+1], _back_wheel_offsets[model],
+                            _car_textures[3*model+2], _exhaust_pipe_offsets[model]);
+  }
 
-protected:
   void podium() { // set ranks for each player
     // https://stackoverflow.com/questions/9025084/sorting-a-vector-in-descending-order
     std::vector<int> scores_sorted = _scores;
     std::sort(scores_sorted.begin(), scores_sorted.end(), std::greater<int>());
-    for (int rank = 2; rank >= 0; --rank) {
+    for (int rank = std::min(2, (int) _nplayers - 1); rank >= 0; --rank) {
       for (unsigned int i = 0; i < _nplayers; ++i) {
         if (_scores[i] == scores_sorted[rank])
           _cars[i].rank = rank;
@@ -616,59 +1280,136 @@ protected:
     } // end for rannk
   } // end podium()
 
-  //! \return true if render OK or already done
-  bool render_time(const int time, int r, int g, int b) {
-    if (_last_renderer_time == time)
-      return true;
-    std::ostringstream time_str; time_str << time;
-    _last_renderer_time = time;
-    return _time_texture.loadFromRenderedText(renderer, _time_font, time_str.str(),
-                                              r, g, b);
-  }
+  //! the simulated time since the last change of game status (seconds)
+  inline double status_time() const { return _clock.now() - _status_start_time; }
 
   SDL_Window* window;
   SDL_Renderer* renderer;
+  bool _headless;
   int _winw, _winh;
   unsigned int _nplayers;
-  Timer _game_timer;
+  bool _autopilot; //!< if true, the cars are driven by the computer
+  SimClock _clock;
+  double _status_start_time;
   GameStatus _game_status;
+  // assets stuff - the bundle must outlive the textures using its pixels
+  AssetBundle _bundle;
   // joystick stuff
   std::vector<SDL_Joystick*> gameControllers;
   // score stuff
   TTF_Font *_score_font;
-  std::vector<Texture> _score_textures;
+  GlyphCache _score_glyphs;
   std::vector<int> _scores;
   // time display stuff
   TTF_Font *_time_font;
-  int _last_renderer_time;
-  Texture _time_texture;
+  int _last_renderer_time; //!< the last time drawn, to play the sfx once
+  GlyphCache _time_glyphs;
   // music stuff
   Mix_Music *_music;
   Mix_Chunk* _grab_collectable_sfx, *_last_lap_fanfare_sfx, *_pre_start_race_sfx,
   *_race_finish_sfx, *_start_race_sfx, *_track_intro_sfx;
   // candy stuff
-  Candy _candy;
+  std::vector<Candy> _candies;
+  SpatialGrid _candy_grid;
+  std::vector<unsigned int> _candy_candidates;
+  FrameArena _arena; //!< the data that only lives during a tick, e.g. _candy_grid
   std::vector<Texture> _candy_textures;
   // cars stuff
   std::vector<Car> _cars;
-  std::vector<Texture> _car_textures;
+  ResourceCache _resources;
+  std::vector<Texture*> _car_textures; //!< body, front and back wheels of each player, in _resources
+  std::vector<Point2d> _front_wheel_offsets, _back_wheel_offsets, _exhaust_pipe_offsets;
   std::vector<Texture> _cup_textures;
+  // the data of the cars, candies and fishes, that are handles on it
+  EntityStore _entities;
   // fish stuff
   std::vector<Fish> _fishes;
+  std::vector<unsigned char> _fish_visible; //!< set by FishesJob
   std::vector<Texture> _fish_textures;
   // bublle stuff
   BubbleManager _bubble_man;
+  // parallel update stuff
+  JobSystem _jobs;
+  std::vector<BubbleBuffer> _car_bubbles; //!< one per chunk of cars
   Texture _bubble_tex;
+  // rendering stuff
+  TextureAtlas _atlas;
+  SpriteBatch _batch;
+  // profiling stuff
+  FrameProfiler _profiler;
+  bool _show_profiler;
+  // threading stuff
+  bool _threaded; //!< true during run_threaded()
+  SDL_atomic_t _running; //!< cleared to stop run_threaded()
+  bool _sim_ok; //!< false if the simulation thread failed
+  SDL_mutex* _events_mutex; //!< protects _events
+  std::vector<SDL_Event> _events, _sim_events; //!< polled, and being applied by update()
+  SnapshotBuffer _snapshots;
+  WorldSnapshot _snapshot; //!< drawn by render()
+  AllocMeter _tick_allocs, _race_allocs;
 }; // end Game
 
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
 int main(int argc, char** argv) {
-  srand(time(NULL));
-  srand48(time(NULL));
-  if (argc == 2) {
-    printf("Synposis: %s winw winh [players_names]\n", argv[0]);
+  // extract options, the remaining arguments are positional
+  bool headless = false, vsync = false, stress = false, keep_surfaces = false;
+  int nthreads = -1;
+  std::vector<unsigned int> stress_sizes;
+  unsigned int nraces = 100;
+  long seed = time(NULL);
+  std::string profile_csv, trace_json;
+  std::vector<std::string> args;
+  for (int argi = 0; argi < argc; ++argi) {
+    std::string arg = argv[argi];
+    if (arg == "--headless") {
+      headless = true;
+      if (argi + 1 < argc && isdigit(argv[argi+1][0]))
+        nraces = atoi(argv[++argi]);
+    }
+    else if (arg == "--vsync")
+      vsync = true;
+    else if (arg == "--keep-surfaces")
+      keep_surfaces = true;
+    else if (arg == "--stress") {
+      stress = true;
+      if (argi + 1 < argc && isdigit(argv[argi+1][0])) { // comma-separated sizes
+        std::istringstream sizes(argv[++argi]);
+        std::string size;
+        while (std::getline(sizes, size, ','))
+          stress_sizes.push_back(std::max(1, atoi(size.c_str())));
+      }
+    }
+    else if (arg == "--seed" && argi + 1 < argc)
+      seed = atol(argv[++argi]);
+    else if (arg == "--threads" && argi + 1 < argc)
+      nthreads = atoi(argv[++argi]);
+    else if (arg == "--profile" && argi + 1 < argc)
+      profile_csv = argv[++argi];
+    else if (arg == "--trace" && argi + 1 < argc)
+      trace_json = argv[++argi];
+    else
+      args.push_back(arg);
+  }
+  unsigned int nargs = args.size();
+  if (nargs == 2) {
+    printf("Synposis: %s [--headless [nraces]] [--stress [sizes]] [--vsync] [--keep-surfaces] [--seed seed] [--threads n] [--profile out.csv] [--trace out.json] winw winh [players_names]\n", argv[0]);
+    printf("  --headless: run nraces races without display nor sound,\n");
+    printf("              as fast as possible, and report races per second [default: 100]\n");
+    printf("  --stress: measure the update and render times with more and more fishes,\n");
+    printf("            bubbles, candies and cars, against the budgets of 60 and 120 Hz.\n");
+    printf("            sizes: comma-separated multipliers of the scene [default: 1,2,5,10,20,50,100]\n");
+    printf("            Runs without screen with SDL_VIDEODRIVER=dummy\n");
+    printf("  --vsync:  synchronize the display with the vertical blank of the screen\n");
+    printf("  --keep-surfaces: keep the pixels of the pictures in memory once uploaded,\n");
+    printf("            and not only the collision masks of the cars and candies\n");
+    printf("  --seed:   seed of the random generators, two runs with the same seed\n");
+    printf("            and the same inputs are identical [default: current time]\n");
+    printf("  --threads: the number of threads updating the entities [default: one per core]\n");
+    printf("  --profile: write the time of each phase of each frame in out.csv (ms)\n");
+    printf("  --trace:  write the spans of the loading, of the frames and of the collisions\n");
+    printf("            in out.json, to open in chrome://tracing or ui.perfetto.dev\n");
     printf("  winw:     window width  in pixels [default: 800]\n");
     printf("  winh:     window height in pixels [default: 600]\n");
     printf("  player_names: names of players, between 1 and 10\n");
@@ -678,32 +1419,72 @@ int main(int argc, char** argv) {
   }
   std::vector<std::string> player_names;
   int winw = 600, winh = 600;
-  if (argc >= 3) {
-    winw = atoi(argv[1]);
-    winh = atoi(argv[2]);
+  if (nargs >= 3) {
+    winw = atoi(args[1].c_str());
+    winh = atoi(args[2].c_str());
   }
-  if (argc < 4) { // exename winw winh p1
+  if (nargs < 4) { // exename winw winh p1
     player_names.push_back("twingo_arnaud");
     player_names.push_back("twingo_unai");
   }
-  for (int argi = 3; argi < argc; ++argi)
-    player_names.push_back(argv[argi]);
+  for (unsigned int argi = 3; argi < nargs; ++argi)
+    player_names.push_back(args[argi]);
+  srand(seed);
+  srand48(seed);
+  if (!trace_json.empty())
+    Tracer::instance().start();
+  if (stress) {
+    if (stress_sizes.empty()) {
+      unsigned int sizes[] = {1, 2, 5, 10, 20, 50, 100};
+      stress_sizes.assign(sizes, sizes + 7);
+    }
+    vsync = false; // as fast as possible
+    SDL_setenv("SDL_AUDIODRIVER", "dummy", 1); // silent
+  }
   Game game;
-  if (!game.init(winw, winh, player_names)) {
+  if (!game.init(winw, winh, player_names, headless, vsync, nthreads, keep_surfaces)) {
     printf("game.init() failed!\n");
     return false;
   }
-  Rate rate(20);
-  while (true) {
-    if (!game.update()){
-      printf("game.update() failed!\n");
-      break;
-    }
-    if (!game.render()){
-      printf("game.render() failed!\n");
-      break;
+  if (!profile_csv.empty() && !game.profiler().open_csv(profile_csv))
+    return -1;
+  if (stress) {
+    bool ok = game.run_stress(stress_sizes);
+    game.profiler().print_stats();
+    if (!trace_json.empty())
+      Tracer::instance().write(trace_json);
+    return (game.clean() && ok ? 0 : -1);
+  }
+  if (headless) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    unsigned int race = 0;
+    for (; race < nraces; ++race) {
+      if (!game.run_headless_race()) {
+        printf("game.run_headless_race() failed!\n");
+        break;
+      }
     }
-    rate.sleep();
+    double elapsed = 1. * (SDL_GetPerformanceCounter() - start)
+        / SDL_GetPerformanceFrequency();
+    printf("%i races in %g s: %g races per second (checksum:%lu)\n",
+           race, elapsed, race / elapsed, game.checksum());
+    game.profiler().print_stats();
+    game.tick_allocs().print_stats("Allocations of the ticks");
+    game.race_allocs().print_stats("Allocations of the race ticks");
+    if (!ALLOC_STATS)
+      printf("Allocations not counted: build with cmake -DCARS_ALLOC_STATS=ON to check them\n");
+    // once started, a race must not touch the heap
+    bool race_allocs = (game.race_allocs().nallocating() > 0);
+    if (race_allocs)
+      printf("Error: %lu ticks of the races allocated on the heap!\n",
+             game.race_allocs().nallocating());
+    if (!trace_json.empty())
+      Tracer::instance().write(trace_json);
+    return (game.clean() && race == nraces && !race_allocs ? 0 : -1);
   }
-  return (game.clean() ? 0 : -1);
+  bool ok = game.run_threaded(vsync);
+  game.profiler().print_stats();
+  if (!trace_json.empty())
+    Tracer::instance().write(trace_json);
+  return (game.clean() && ok ? 0 : -1);
 } // end main()
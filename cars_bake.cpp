@@ -0,0 +1,105 @@
+/*!
+  \file        cars_bake.cpp
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+Bake the pictures of the game into an asset bundle:
+they are decoded, scaled and masked once here, instead of at each launch.
+The sizes must be the same as in Game::init():
+a picture missing from the bundle is loaded from its PNG file.
+
+Synopsis:
+  cars_bake [OUTPUT]
+  OUTPUT defaults to data/cars.bundle, where the game looks for it.
+ */
+#include "asset_bundle.h"
+
+class Baker {
+public:
+  Baker(const std::string & graphics_path) : _graphics_path(graphics_path), _ok(true) {}
+
+  //! same parameters as Texture::from_file(), \return the resize scale
+  double bake(const std::string & name,
+              int goalwidth = -1, int goalheight = -1, double goalscale = -1,
+              int mask_minalpha = 1) {
+    Texture tex;
+    if (!tex.from_file(NULL, _graphics_path + name,
+                       goalwidth, goalheight, goalscale, mask_minalpha)
+        || !_writer.add(AssetBundle::key(name, goalwidth, goalheight, goalscale, mask_minalpha),
+                        tex)) {
+      _ok = false;
+      return 1;
+    }
+    printf("%-40s %4ix%-4i\n", name.c_str(), tex.get_width(), tex.get_height());
+    return tex.get_resize_scale();
+  }
+
+  inline bool ok() const { return _ok; }
+  inline bool write(const std::string & filename) const { return _writer.write(filename); }
+  inline unsigned int size() const { return _writer.size(); }
+
+private:
+  std::string _graphics_path;
+  bool _ok;
+  AssetBundleWriter _writer;
+}; // end class Baker
+
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+  int imgFlags = IMG_INIT_PNG;
+  if( !( IMG_Init( imgFlags ) & imgFlags ) ) {
+    printf( "SDL_image could not initialize! SDL_image Error: %s\n", IMG_GetError() );
+    return -1;
+  }
+  char* base_path_c = SDL_GetBasePath();
+  std::string base_path = base_path_c,
+      data_path = base_path + "../data/",
+      output = (argc > 1 ? argv[1] : data_path + "cars.bundle");
+  SDL_free(base_path_c);
+
+  // same sizes and thresholds as in Game::init()
+  Baker baker(data_path + "graphics/");
+  int collision_minalpha = 80;
+  baker.bake("bubble.png", 50);
+  baker.bake("candy/chuche1.png", 100, -1, -1, collision_minalpha);
+  baker.bake("candy/chuche2.png", 50, -1, -1, collision_minalpha);
+  baker.bake("candy/huevo.png", 80, -1, -1, collision_minalpha);
+  unsigned int car_width = 200, cup_width = 64; // px
+  baker.bake("cup_gold.png", cup_width);
+  baker.bake("cup_silver.png", cup_width);
+  baker.bake("cup_bronze.png", cup_width);
+  const char* cars[] = {"2cv", "cabrio", "twingo_ainara", "twingo_arnaud",
+                        "twingo_red", "twingo_unai"};
+  for (unsigned int i = 0; i < 6; ++i) {
+    std::string carfile = std::string("cars/") + cars[i];
+    double scale = baker.bake(carfile + ".png", car_width, -1, -1, collision_minalpha);
+    baker.bake(carfile + "_front_wheel.png", -1, -1, scale);
+    baker.bake(carfile + "_back_wheel.png", -1, -1, scale);
+  }
+  int fish_size = 100; // px
+  for (unsigned int i = 0; i < 8; ++i) {
+    std::ostringstream filename;
+    filename << "fish/pez"<< i+1 << ".png";
+    baker.bake(filename.str(), fish_size);
+  }
+
+  bool ok = baker.ok() && baker.write(output);
+  if (ok)
+    printf("Wrote %i pictures in '%s'\n", baker.size(), output.c_str());
+  IMG_Quit();
+  return (ok ? 0 : -1);
+} // end main()
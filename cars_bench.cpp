@@ -0,0 +1,563 @@
+/*!
+  \file        cars_bench.cpp
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+Micro-benchmarks of the geometry, collision, bubble and resampling routines,
+without display, on the pictures of data/graphics.
+Each benchmark prints one CSV line: "name,iterations,ns_per_iteration".
+The SIMD collision and resampling kernels are first checked against
+the scalar ones, and the collision kernels against the floating-point
+stepping they replaced: the program returns -1 if they disagree.
+ */
+#include "bubbles.h"
+#include "entity.h"
+
+//! run f() repeatedly during at least min_sec and print the time per call
+template<class Functor>
+double bench(const std::string & name, Functor & f, double min_sec = .2) {
+  Uint64 freq = SDL_GetPerformanceFrequency(), start = SDL_GetPerformanceCounter();
+  unsigned long niters = 0, batch = 1;
+  double elapsed = 0;
+  while (elapsed < min_sec) {
+    for (unsigned long i = 0; i < batch; ++i)
+      f();
+    niters += batch;
+    batch *= 2;
+    elapsed = 1. * (SDL_GetPerformanceCounter() - start) / freq;
+  }
+  double ns = 1E9 * elapsed / niters;
+  printf("%s,%lu,%g\n", name.c_str(), niters, ns);
+  return ns;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! random points in [-range, range]^2
+std::vector<Point2d> random_points(unsigned int npts, double range) {
+  std::vector<Point2d> pts;
+  for (unsigned int i = 0; i < npts; ++i)
+    pts.push_back(Point2d(range * (2 * drand48() - 1), range * (2 * drand48() - 1)));
+  return pts;
+}
+
+//! a rectangle of size \arg w x \arg h centered on \arg c, rotated by \arg angle
+std::vector<Point2d> rotated_rectangle(const Point2d & c, double w, double h, double angle) {
+  std::vector<Point2d> rect;
+  double cx[] = {-.5, .5, .5, -.5}, cy[] = {-.5, -.5, .5, .5};
+  for (unsigned int i = 0; i < 4; ++i)
+    rect.push_back(c + rotate(Point2d(w * cx[i], h * cy[i]), angle));
+  return rect;
+}
+
+//! the results are accumulated in sum, so that the compiler keeps the computations
+struct Point2Bench {
+  enum Mode { ARITHMETIC, ROTATE };
+  void operator()() {
+    const Point2d & a = pts[idx], & b = pts[(idx + 1) % pts.size()];
+    if (mode == ARITHMETIC) {
+      Point2d c = a + b;
+      c += .5 * (a - b);
+      sum += c.norm() + a.dot(b);
+    }
+    else
+      sum += rotate(a, b.x).y;
+    idx = (idx + 1) % pts.size();
+  }
+  Mode mode;
+  std::vector<Point2d> pts;
+  unsigned int idx;
+  double sum;
+};
+
+struct PointInPolygonBench {
+  void operator()() {
+    ninside += point_inside_polygon(pts[idx], poly);
+    idx = (idx + 1) % pts.size();
+  }
+  std::vector<Point2d> pts, poly;
+  unsigned int idx, ninside;
+};
+
+//! pairs of rotated rectangles of the size of a car, a part of them intersecting
+struct RectanglesBench {
+  void init(unsigned int npairs, bool with_overlap) {
+    for (unsigned int i = 0; i < npairs; ++i) {
+      As.push_back(rotated_rectangle(Point2d(), 200, 100, drand48() * 2 * M_PI));
+      Bs.push_back(rotated_rectangle(random_points(1, 200).front(), 200, 100,
+                                     drand48() * 2 * M_PI));
+    }
+    overlap = (with_overlap ? &rect : NULL);
+    idx = nhits = 0;
+  }
+  void operator()() {
+    nhits += IsRectanglesIntersecting(&As[idx][0], &Bs[idx][0], overlap);
+    idx = (idx + 1) % As.size();
+  }
+  std::vector< std::vector<Point2d> > As, Bs;
+  SDL_Rect rect, *overlap;
+  unsigned int idx, nhits;
+};
+
+struct GetPixelBench {
+  void operator()() {
+    const Point2i & p = pts[idx];
+    sum += getpixel(surface, p.x, p.y);
+    idx = (idx + 1) % pts.size();
+  }
+  SDL_Surface* surface;
+  std::vector<Point2i> pts;
+  unsigned int idx;
+  Uint32 sum;
+};
+
+/*! one tick of BubbleManager::update() with a constant number of bubbles:
+  the window is so large that they almost never leave it,
+  the few that do are created again */
+struct BubblesBench {
+  void init(Texture* tex, unsigned int nbubbles) {
+    winw = winh = 1000000;
+    n = nbubbles;
+    bubbles.set_texture(tex);
+    bubbles.set_capacity(n);
+    refill();
+  }
+  void refill() {
+    while (bubbles.size() < n)
+      bubbles.create_bubble(Point2d(drand48() * winw, drand48() * winh), .2 + drand48());
+  }
+  void operator()() {
+    clock.tick();
+    bubbles.update(clock, winw, winh);
+    refill();
+  }
+  BubbleManager bubbles;
+  SimClock clock;
+  unsigned int n;
+  int winw, winh;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! a random span crossing both masks, partly out of them
+struct RandomSpan {
+  void randomize(const AlphaMask & A, const AlphaMask & B) {
+    double angA = drand48() * 2 * M_PI, angB = drand48() * 2 * M_PI;
+    fa[0] = drand48() * A.get_width();
+    fa[1] = drand48() * A.get_height();
+    fa[2] = cos(angA);
+    fa[3] = sin(angA);
+    fb[0] = drand48() * B.get_width();
+    fb[1] = drand48() * B.get_height();
+    fb[2] = cos(angB);
+    fb[3] = sin(angB);
+    ax = to_mask_fixed(fa[0]);
+    ay = to_mask_fixed(fa[1]);
+    adx = to_mask_fixed(fa[2]);
+    ady = to_mask_fixed(fa[3]);
+    bx = to_mask_fixed(fb[0]);
+    by = to_mask_fixed(fb[1]);
+    bdx = to_mask_fixed(fb[2]);
+    bdy = to_mask_fixed(fb[3]);
+    n = 1 + rand() % 300;
+  }
+  int run(MaskSpanKernel kernel, const AlphaMask & A, const AlphaMask & B) const {
+    return kernel(A, ax, ay, adx, ady, B, bx, by, bdx, bdy, n);
+  }
+  int ax, ay, adx, ady, bx, by, bdx, bdy, n;
+  double fa[4], fb[4]; //!< the same span in floating point: x, y, dx, dy
+};
+
+struct SpanBench {
+  void operator()() {
+    spans[idx].run(kernel, *A, *B);
+    idx = (idx + 1) % spans.size();
+  }
+  MaskSpanKernel kernel;
+  const AlphaMask *A, *B;
+  std::vector<RandomSpan> spans;
+  unsigned int idx;
+};
+
+//! a car and a candy in random relative poses, a part of them overlapping
+struct CollisionBench {
+  void init(Texture* car_tex, Texture* candy_tex, double dist, unsigned int nposes,
+            double scale = 1) {
+    car.create(store);
+    candy.create(store);
+    car.set_texture(car_tex);
+    candy.set_texture(candy_tex);
+    car.set_rendering_scale(scale);
+    candy.set_rendering_scale(scale);
+    dist *= scale;
+    for (unsigned int i = 0; i < nposes; ++i) {
+      double ang = drand48() * 2 * M_PI;
+      candy_pos.push_back(Point2d(dist * cos(ang), dist * sin(ang)));
+      car_angles.push_back(drand48() * 2 * M_PI);
+    }
+    idx = 0;
+  }
+  bool operator()() {
+    car.set_angle(car_angles[idx]);
+    candy.set_position(candy_pos[idx]);
+    idx = (idx + 1) % candy_pos.size();
+    return car.collides_with(candy);
+  }
+  EntityStore store;
+  Entity car, candy;
+  std::vector<Point2d> candy_pos;
+  std::vector<double> car_angles;
+  unsigned int idx;
+};
+
+//! a picture of the game, scaled to its size in the game
+struct ScaleBench {
+  enum Mode { SCALE_SURFACE, RESAMPLE };
+  void operator()() {
+    SDL_Surface* out = (mode == SCALE_SURFACE ? ScaleSurface(src, w, h)
+                                              : resample_surface(src, w, h, false, pool));
+    SDL_FreeSurface(out);
+  }
+  Mode mode;
+  SDL_Surface* src;
+  int w, h;
+  ThreadPool* pool;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// the reference of the kernels: the span stepped pixel by pixel in floating point,
+// as the collisions did before the fixed-point kernels
+
+//! the pixel of a coordinate, clamped onto the mask as the kernels do
+inline int mask_float_pixel(double v, int size) {
+  return std::min(std::max((int) floor(v), 0), size - 1);
+}
+
+//! mask_span_first_hit_scalar() in floating point: a[] and b[] are x, y, dx, dy
+int mask_span_first_hit_float(const AlphaMask & A, const double* a,
+                              const AlphaMask & B, const double* b, int n) {
+  for (int t = 0; t < n; ++t) {
+    if (A.get(mask_float_pixel(a[0] + t * a[2], A.get_width()),
+              mask_float_pixel(a[1] + t * a[3], A.get_height()))
+        && B.get(mask_float_pixel(b[0] + t * b[2], B.get_width()),
+                 mask_float_pixel(b[1] + t * b[3], B.get_height())))
+      return t;
+  } // end loop t
+  return -1;
+}
+
+/*! the fixed-point kernels round the start and the step of the spans
+ * to 1/65536 px: at step \arg t, their position is within (t+1)/131072 px
+ * of the exact one. They can only read another pixel than the floating-point
+ * stepping when a coordinate is that close to the edge of a pixel.
+ */
+bool near_pixel_edge(const double* a, const double* b, int t) {
+  double tol = (t + 1.) / (2 * MASK_FIXED_ONE) + 1E-9;
+  double coords[4] = { a[0] + t * a[2], a[1] + t * a[3], b[0] + t * b[2], b[1] + t * b[3] };
+  for (unsigned int i = 0; i < 4; ++i) {
+    if (fabs(coords[i] - floor(coords[i] + .5)) <= tol)
+      return true;
+  }
+  return false;
+}
+
+//! Entity::collides_with() with the spans stepped in floating point
+bool collides_with_float(const Entity & ea, const Entity & eb) {
+  if ((ea.get_position() - eb.get_position()).norm()
+      > ea.get_entity_radius() + eb.get_entity_radius())
+    return false;
+  SDL_Rect inter;
+  if (!IsRectanglesIntersecting(ea.get_tight_bbox(), eb.get_tight_bbox(), &inter))
+    return false;
+  const AlphaMask & mA = ea.get_texture()->get_mask(), & mB = eb.get_texture()->get_mask();
+  Point2d dAx, dAy, dBx, dBy;
+  ea.world_steps2offset(dAx, dAy);
+  eb.world_steps2offset(dBx, dBy);
+  Point2d A0 = ea.world_pos2offset(Point2d(inter.x, inter.y)),
+      B0 = eb.world_pos2offset(Point2d(inter.x, inter.y));
+  for (int y = 0; y < inter.h; ++y) {
+    Point2d PA = A0 + y * dAy, PB = B0 + y * dBy;
+    double tmin = 0, tmax = inter.w - 1;
+    if (!clip_span(PA.x, dAx.x, mA.get_width(), tmin, tmax)
+        || !clip_span(PA.y, dAx.y, mA.get_height(), tmin, tmax)
+        || !clip_span(PB.x, dBx.x, mB.get_width(), tmin, tmax)
+        || !clip_span(PB.y, dBx.y, mB.get_height(), tmin, tmax))
+      continue;
+    int t0 = ceil(tmin), t1 = floor(tmax);
+    if (t0 > t1)
+      continue;
+    PA += t0 * dAx;
+    PB += t0 * dBx;
+    double a[4] = { PA.x, PA.y, dAx.x, dAx.y }, b[4] = { PB.x, PB.y, dBx.x, dBx.y };
+    if (mask_span_first_hit_float(mA, a, mB, b, t1 - t0 + 1) >= 0)
+      return true;
+  } // end loop y
+  return false;
+}
+
+/*! check that all the supported kernels give the same results as the scalar one,
+ * and the same as the floating-point stepping, but on the edges of the pixels.
+ * The collisions of the kernels and of the floating-point stepping
+ * can differ on a few poses, where two pictures touch by a single pixel:
+ * at most COLLISION_TOLERANCE of them.
+ */
+bool check_mask_kernels(Texture & car_tex, Texture & candy_tex) {
+  static const double COLLISION_TOLERANCE = 1E-3;
+  bool ok = true;
+  const AlphaMask & A = car_tex.get_mask(), & B = candy_tex.get_mask();
+  // spans
+  unsigned int nspans = 100000, nspans_off = 0;
+  for (unsigned int i = 0; i < nspans && ok; ++i) {
+    RandomSpan span;
+    span.randomize(A, B);
+    int ref = span.run(mask_span_first_hit_scalar, A, B);
+    int fref = mask_span_first_hit_float(A, span.fa, B, span.fb, span.n);
+    if (fref != ref) {
+      // the first pixel where they differ
+      int t = (ref < 0 ? fref : fref < 0 ? ref : std::min(ref, fref));
+      ++nspans_off;
+      if (!near_pixel_edge(span.fa, span.fb, t)) {
+        printf("The scalar kernel disagrees with the floating-point stepping on span %i: %i != %i\n",
+               i, ref, fref);
+        ok = false;
+      }
+    }
+    for (int type = MASK_KERNEL_SCALAR + 1; type < NMASK_KERNELS; ++type) {
+      if (!set_mask_kernel((MaskKernelType) type))
+        continue;
+      int hit = span.run(mask_span_kernel(), A, B);
+      if (hit == ref)
+        continue;
+      printf("Kernel '%s' disagrees with the scalar one on span %i: %i != %i\n",
+             mask_kernel_name((MaskKernelType) type), i, hit, ref);
+      ok = false;
+    } // end loop type
+  } // end loop i
+  // full collisions
+  CollisionBench coll;
+  coll.init(&car_tex, &candy_tex, 100, 1);
+  unsigned int ncollisions = 10000, ncollisions_off = 0;
+  for (unsigned int i = 0; i < ncollisions && ok; ++i) {
+    coll.car.set_angle(drand48() * 2 * M_PI);
+    coll.candy.set_angle(drand48() * 2 * M_PI);
+    coll.candy.set_position(Point2d(200 * (drand48() - .5), 200 * (drand48() - .5)));
+    set_mask_kernel(MASK_KERNEL_SCALAR);
+    bool ref = coll.car.collides_with(coll.candy);
+    if (ref != collides_with_float(coll.car, coll.candy))
+      ++ncollisions_off;
+    for (int type = MASK_KERNEL_SCALAR + 1; type < NMASK_KERNELS; ++type) {
+      if (!set_mask_kernel((MaskKernelType) type))
+        continue;
+      if (coll.car.collides_with(coll.candy) == ref)
+        continue;
+      printf("Kernel '%s' disagrees with the scalar one on collision %i\n",
+             mask_kernel_name((MaskKernelType) type), i);
+      ok = false;
+    } // end loop type
+  } // end loop i
+  set_mask_kernel(best_mask_kernel());
+  printf("# mask kernels vs floating-point stepping: %i of %i spans and %i of %i collisions "
+         "differ, on the edges of the pixels\n", nspans_off, nspans, ncollisions_off, ncollisions);
+  if (ncollisions_off > COLLISION_TOLERANCE * ncollisions) {
+    printf("Too many collisions differ from the floating-point stepping\n");
+    ok = false;
+  }
+  return ok;
+}
+
+//! check that all the supported resampling kernels give the same pixels
+bool check_resample_kernels(SDL_Surface* src) {
+  bool ok = true;
+  int sizes[][2] = { {200, 100}, {src->w / 3, src->h / 7}, {2 * src->w, src->h + 1} };
+  for (unsigned int s = 0; s < 3 && ok; ++s) {
+    int w = sizes[s][0], h = sizes[s][1];
+    set_resample_kernel(RESAMPLE_KERNEL_SCALAR);
+    SDL_Surface* ref = resample_surface(src, w, h);
+    for (int type = RESAMPLE_KERNEL_SCALAR + 1; type < NRESAMPLE_KERNELS; ++type) {
+      if (!set_resample_kernel((ResampleKernelType) type))
+        continue;
+      SDL_Surface* out = resample_surface(src, w, h);
+      for (int y = 0; y < h && ok; ++y) {
+        if (memcmp((Uint8*) ref->pixels + y * ref->pitch, (Uint8*) out->pixels + y * out->pitch, 4 * w))
+          ok = false;
+      }
+      if (!ok)
+        printf("Resampling kernel '%s' disagrees with the scalar one at %ix%i\n",
+               resample_kernel_name((ResampleKernelType) type), w, h);
+      SDL_FreeSurface(out);
+    } // end loop type
+    SDL_FreeSurface(ref);
+  } // end loop s
+  set_resample_kernel(best_resample_kernel());
+  return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int, char**) {
+  srand(0);
+  srand48(0);
+  int imgFlags = IMG_INIT_PNG;
+  if( !( IMG_Init( imgFlags ) & imgFlags ) ) {
+    printf( "SDL_image could not initialize! SDL_image Error: %s\n", IMG_GetError() );
+    return -1;
+  }
+  char* base_path_c = SDL_GetBasePath();
+  std::string base_path = base_path_c,
+      graphics_path = base_path + "../data/graphics/";
+  SDL_free(base_path_c);
+  // same sizes and thresholds as in the game
+  Texture car_tex, candy_tex, bubble_tex;
+  if (!car_tex.from_file(NULL, graphics_path + "cars/twingo_red.png", 200, -1, -1, 80)
+      || !candy_tex.from_file(NULL, graphics_path + "candy/huevo.png", 80, -1, -1, 80)
+      || !bubble_tex.from_file(NULL, graphics_path + "bubble.png", 50))
+    return -1;
+  printf("# best mask kernel: %s\n", mask_kernel_name(best_mask_kernel()));
+  printf("# best resampling kernel: %s\n", resample_kernel_name(best_resample_kernel()));
+  if (!check_mask_kernels(car_tex, candy_tex))
+    return -1;
+  // the pictures of the game, before scaling, and their size in the game
+  const char* pictures[] = {"cars/twingo_red.png", "cars/2cv.png", "fish/pez1.png",
+                            "candy/chuche1.png", "bubble.png"};
+  int widths[] = {200, 200, 100, 100, 50};
+  std::vector<SDL_Surface*> sources;
+  for (unsigned int i = 0; i < 5; ++i) {
+    SDL_Surface* src = IMG_Load((graphics_path + pictures[i]).c_str());
+    if (src == NULL) {
+      printf("Unable to load image %s! SDL Error: %s\n", pictures[i], SDL_GetError());
+      return -1;
+    }
+    sources.push_back(src);
+  }
+  if (!check_resample_kernels(sources[0]))
+    return -1;
+  printf("name,iterations,ns_per_iteration\n");
+
+  // geometry
+  Point2Bench point_bench;
+  point_bench.pts = random_points(1000, 500);
+  point_bench.idx = 0;
+  point_bench.sum = 0;
+  point_bench.mode = Point2Bench::ARITHMETIC;
+  bench("point2_arithmetic", point_bench);
+  point_bench.mode = Point2Bench::ROTATE;
+  bench("point2_rotate", point_bench);
+  PointInPolygonBench inside_bench;
+  inside_bench.pts = random_points(1000, 150);
+  inside_bench.idx = inside_bench.ninside = 0;
+  inside_bench.poly = rotated_rectangle(Point2d(), 200, 100, .3);
+  bench("point_inside_polygon_4", inside_bench);
+  inside_bench.poly.clear(); // a circle
+  for (unsigned int i = 0; i < 32; ++i)
+    inside_bench.poly.push_back(100 * Point2d(cos(i * M_PI / 16), sin(i * M_PI / 16)));
+  bench("point_inside_polygon_32", inside_bench);
+  RectanglesBench rectangles_bench;
+  rectangles_bench.init(1000, false);
+  bench("rectangles_intersecting", rectangles_bench);
+  RectanglesBench overlap_bench;
+  overlap_bench.init(1000, true);
+  bench("rectangles_overlap", overlap_bench);
+
+  // pixels
+  GetPixelBench pixel_bench;
+  pixel_bench.surface = car_tex.get_sdl_surface();
+  for (unsigned int i = 0; i < 1000; ++i)
+    pixel_bench.pts.push_back(Point2i(rand() % pixel_bench.surface->w,
+                                      rand() % pixel_bench.surface->h));
+  pixel_bench.idx = pixel_bench.sum = 0;
+  bench("getpixel", pixel_bench);
+
+  // bubbles
+  for (unsigned int n = 10; n <= 100000; n *= 10) {
+    BubblesBench bubbles_bench;
+    bubbles_bench.init(&bubble_tex, n);
+    std::ostringstream name;
+    name << "bubbles_update_" << n;
+    bench(name.str(), bubbles_bench);
+  } // end loop n
+
+  // span kernels
+  SpanBench span_bench;
+  span_bench.A = &car_tex.get_mask();
+  span_bench.B = &candy_tex.get_mask();
+  span_bench.spans.resize(1000);
+  for (unsigned int i = 0; i < span_bench.spans.size(); ++i)
+    span_bench.spans[i].randomize(*span_bench.A, *span_bench.B);
+  for (int type = MASK_KERNEL_SCALAR; type < NMASK_KERNELS; ++type) {
+    if (!set_mask_kernel((MaskKernelType) type))
+      continue;
+    span_bench.kernel = mask_span_kernel();
+    span_bench.idx = 0;
+    bench(std::string("mask_span_") + mask_kernel_name((MaskKernelType) type), span_bench);
+  } // end loop type
+
+  // car vs candy, at different distances
+  double dists[] = {0, 60, 120};
+  for (unsigned int d = 0; d < 3; ++d) {
+    CollisionBench coll;
+    coll.init(&car_tex, &candy_tex, dists[d], 1000);
+    for (int type = MASK_KERNEL_SCALAR; type < NMASK_KERNELS; ++type) {
+      if (!set_mask_kernel((MaskKernelType) type))
+        continue;
+      std::ostringstream name;
+      name << "collides_with_dist" << dists[d] << "_" << mask_kernel_name((MaskKernelType) type);
+      bench(name.str(), coll);
+    } // end loop type
+  } // end loop d
+  set_mask_kernel(best_mask_kernel());
+  // overlapping car and candy, at different scales
+  double scales[] = {.5, 1, 2};
+  for (unsigned int s = 0; s < 3; ++s) {
+    CollisionBench coll;
+    coll.init(&car_tex, &candy_tex, 60, 1000, scales[s]);
+    std::ostringstream name;
+    name << "collides_with_dist60_scale" << scales[s] << "_"
+         << mask_kernel_name(best_mask_kernel());
+    bench(name.str(), coll);
+  } // end loop s
+
+  // ScaleSurface() vs resample_surface(), single and multi-threaded
+  ThreadPool pool;
+  for (unsigned int i = 0; i < sources.size(); ++i) {
+    ScaleBench scale;
+    scale.src = sources[i];
+    scale.w = widths[i];
+    scale.h = std::max(1, widths[i] * sources[i]->h / sources[i]->w);
+    scale.pool = NULL;
+    std::string name = pictures[i];
+    name = name.substr(name.rfind('/') + 1);
+    name = name.substr(0, name.find('.'));
+    scale.mode = ScaleBench::SCALE_SURFACE;
+    bench("scale_surface_" + name, scale);
+    scale.mode = ScaleBench::RESAMPLE;
+    for (int type = RESAMPLE_KERNEL_SCALAR; type < NRESAMPLE_KERNELS; ++type) {
+      if (!set_resample_kernel((ResampleKernelType) type))
+        continue;
+      bench(std::string("resample_") + resample_kernel_name((ResampleKernelType) type)
+            + "_" + name, scale);
+    } // end loop type
+    set_resample_kernel(best_resample_kernel());
+    scale.pool = &pool;
+    std::ostringstream threads_name;
+    threads_name << "resample_" << resample_kernel_name(best_resample_kernel())
+                 << "_" << pool.get_nthreads() << "threads_" << name;
+    bench(threads_name.str(), scale);
+    SDL_FreeSurface(sources[i]);
+  } // end loop i
+  IMG_Quit();
+  return 0;
+} // end main()
@@ -0,0 +1,395 @@
+/*!
+  \file        entity.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+The moving pictures of the game: their data lives in contiguous arrays
+of components, an Entity is a handle on one of them.
+ */
+#ifndef ENTITY_H
+#define ENTITY_H
+
+#include "sdl_utils.h"
+
+/*! The components of all the entities, one element per entity in each array.
+  An entity can be attached to a parent, e.g. the wheels to their car:
+  its position is then set by propagate() from the one of its parent,
+  in a single pass over the arrays, as the parents are created first.
+  The arrays may move when an entity is created: they are only reached
+  through the index of the entity, never kept by pointer.
+*/
+class EntityStore {
+public:
+  static const int NO_ENTITY = -1;
+
+  //! where the entity is drawn
+  struct Transform {
+    Point2d position;
+    double angle, scale; // radians, rendering scale
+  };
+  //! how the entity moves, integrated by Entity::update_pos_speed()
+  struct Kinematics {
+    Point2d speed, accel;
+    double angspeed, age;
+  };
+  //! what is drawn
+  struct Sprite {
+    Texture* tex;
+    double tex_radius; //!< half the diagonal of the texture, before scaling
+  };
+  /*! the transforms between the pixels of the texture and the world,
+   * cached by frame() for the transform and the texture they were made of
+   */
+  struct Frame {
+    Affine2d to_world, to_offset;
+    double cosa, sina; // of the angle
+    // the state the transforms were made of
+    Point2d position;
+    double angle, scale;
+    const Texture* tex;
+    bool valid;
+  };
+  //! the bounding box, oriented as the entity, computed when needed
+  struct Collision {
+    Point2d tight_bbox[4];
+    bool tight_bbox_needed; //!< set when the frame changes
+    Point2d collision_pt; //!< the last pixel found by Entity::collides_with()
+  };
+  //! the parent, and the siblings to walk through the children of a parent
+  struct Hierarchy {
+    int parent, first_child, next_sibling;
+    Point2d offset; //!< in the pixels of the texture of the parent
+  };
+
+  //! \return the index of a new entity, at the origin, without texture nor parent
+  unsigned int create() {
+    Transform t = { Point2d(0, 0), 0, 1 };
+    Kinematics k = { Point2d(0, 0), Point2d(0, 0), 0, 0 };
+    Sprite s = { NULL, 0 };
+    Frame f;
+    f.valid = false;
+    Collision c;
+    c.tight_bbox_needed = true;
+    c.collision_pt = Point2d(-1, -1);
+    Hierarchy h = { NO_ENTITY, NO_ENTITY, NO_ENTITY, Point2d(0, 0) };
+    _transforms.push_back(t);
+    _kinematics.push_back(k);
+    _sprites.push_back(s);
+    _frames.push_back(f);
+    _collisions.push_back(c);
+    _hierarchy.push_back(h);
+    return _transforms.size() - 1;
+  }
+
+  inline unsigned int size() const { return _transforms.size(); }
+  void reserve(unsigned int n) {
+    _transforms.reserve(n);
+    _kinematics.reserve(n);
+    _sprites.reserve(n);
+    _frames.reserve(n);
+    _collisions.reserve(n);
+    _hierarchy.reserve(n);
+  }
+  //! remove all entities: the handles on them become invalid
+  void clear() {
+    _transforms.clear();
+    _kinematics.clear();
+    _sprites.clear();
+    _frames.clear();
+    _collisions.clear();
+    _hierarchy.clear();
+  }
+
+  /*! attach \arg child to \arg parent, at \arg offset in the pixels of its texture.
+   * \return false if the child was created before the parent, or already has one
+   */
+  bool set_parent(unsigned int child, unsigned int parent, const Point2d & offset) {
+    if (child <= parent || _hierarchy[child].parent != NO_ENTITY) {
+      printf("EntityStore: cannot attach entity %i to entity %i\n", child, parent);
+      return false;
+    }
+    Hierarchy & h = _hierarchy[child];
+    h.parent = parent;
+    h.offset = offset;
+    // append to the children of the parent, to keep them in their order
+    int* last = &_hierarchy[parent].first_child;
+    while (*last != NO_ENTITY)
+      last = &_hierarchy[*last].next_sibling;
+    *last = child;
+    return true;
+  }
+
+  /*! integrate the rotation of the children over \arg dt, e.g. the wheels,
+   * and place them on their parents. The parents come first in the arrays:
+   * a single pass places the children of children too.
+   */
+  void propagate(double dt) {
+    unsigned int n = _transforms.size();
+    for (unsigned int i = 0; i < n; ++i) {
+      const Hierarchy & h = _hierarchy[i];
+      if (h.parent == NO_ENTITY)
+        continue;
+      Transform & t = _transforms[i];
+      Kinematics & k = _kinematics[i];
+      k.age += dt;
+      t.angle += dt * k.angspeed;
+      t.position = frame(h.parent).to_world(h.offset);
+    } // end loop i
+  }
+
+  /*! the frame of entity \arg i, made again only if its position, angle,
+   * scale or texture changed since the last call: cos() and sin()
+   * are then computed once per move, whatever the number of conversions.
+   */
+  const Frame & frame(unsigned int i) {
+    Frame & f = _frames[i];
+    const Transform & t = _transforms[i];
+    const Texture* tex = _sprites[i].tex;
+    if (f.valid && f.position == t.position && f.angle == t.angle
+        && f.scale == t.scale && f.tex == tex)
+      return f;
+    f.position = t.position;
+    f.angle = t.angle;
+    f.scale = t.scale;
+    f.tex = tex;
+    f.valid = true;
+    f.cosa = cos(t.angle);
+    f.sina = sin(t.angle);
+    Point2d center = (tex ? tex->center() : Point2d(0, 0));
+    f.to_world = Affine2d::similarity(f.cosa, f.sina, t.scale, center, t.position);
+    f.to_offset = f.to_world.inverse();
+    _collisions[i].tight_bbox_needed = true;
+    return f;
+  }
+
+private:
+  friend class Entity;
+  std::vector<Transform> _transforms;
+  std::vector<Kinematics> _kinematics;
+  std::vector<Sprite> _sprites;
+  std::vector<Frame> _frames;
+  std::vector<Collision> _collisions;
+  std::vector<Hierarchy> _hierarchy;
+}; // end class EntityStore
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*! A handle on an entity of an EntityStore: copying it does not copy
+  the entity, both copies then move the same one.
+  A handle must be given an entity with create() before anything else.
+*/
+class Entity {
+public:
+  Entity() : _store(NULL), _id(0) {}
+
+  //! make this object a handle on a new entity of \arg store
+  void create(EntityStore & store) {
+    _store = &store;
+    _id = store.create();
+  }
+  inline bool is_created() const { return _store != NULL; }
+  inline unsigned int get_id() const { return _id; }
+
+  //! the simulated time since the creation of the entity (seconds)
+  double get_age() const                        { return  kinematics().age; }
+  void set_angle(const double & angle)          { transform().angle = angle; }
+  double get_angle() const                      { return  transform().angle; }
+  void set_angspeed(const double & angspeed)    { kinematics().angspeed = angspeed; }
+  double get_angspeed() const                   { return  kinematics().angspeed; }
+  void increase_angle(const double & dangle)    { transform().angle += dangle; }
+  void set_accel(const Point2d & accel)         { kinematics().accel = accel; }
+  void renorm_accel(const double & newnorm)     { kinematics().accel.renorm(newnorm); }
+  Point2d get_accel() const                     { return  kinematics().accel; }
+  void set_speed(const Point2d & speed)         { kinematics().speed = speed; }
+  void renorm_speed(const double & newnorm)     { kinematics().speed.renorm(newnorm); }
+  Point2d get_speed() const                     { return  kinematics().speed; }
+  void set_tan_nor_speed(const Point2d & speed) {
+    const EntityStore::Frame & f = frame();
+    kinematics().speed = Point2d(ROTATE_COSSIN_X(speed.x, speed.y, f.cosa, f.sina),
+                                 ROTATE_COSSIN_Y(speed.x, speed.y, f.cosa, f.sina));
+  }
+  //! the children are placed by the next EntityStore::propagate()
+  void set_position(const Point2d & position)   { transform().position = position; }
+  Point2d get_position() const                  { return  transform().position; }
+  void advance(const double & dist) {
+    const EntityStore::Frame & f = frame();
+    set_position(get_position() + Point2d(dist * f.cosa, dist * f.sina));
+  }
+  void rotate_towards_speed_direction() {
+    const Point2d & speed = kinematics().speed;
+    if (fabs(speed.y)>1E-2)
+      transform().angle = atan2(speed.y, speed.x);
+  }
+  //! integrate the motion over one tick of the simulation clock.
+  //! The children are moved by the next EntityStore::propagate()
+  void update_pos_speed(const double & dt) {
+    EntityStore::Transform & t = transform();
+    EntityStore::Kinematics & k = kinematics();
+    k.age += dt;
+    t.angle += dt * k.angspeed;
+    k.speed += dt * k.accel;
+    t.position += dt * k.speed;
+  }
+
+  bool set_texture(Texture* texture) {
+    sprite().tex = texture;
+    sprite().tex_radius = hypot(get_width(), get_height()) / 2;
+    return true;
+  } // end from_file()
+  Texture* get_texture() const { return sprite().tex; }
+
+  void set_rendering_scale(const double & rendering_scale) {
+    transform().scale = rendering_scale;
+  }
+  double get_rendering_scale() const                     { return  transform().scale; }
+  double get_tex_radius()      const                     { return  sprite().tex_radius; }
+  double get_entity_radius()   const                     { return  sprite().tex_radius * transform().scale; }
+  inline int get_width() const {
+    return ( get_texture()  ? get_texture()->get_width() : -1);
+  }
+  inline int get_height() const {
+    return (get_texture()  ? get_texture()->get_height() : -1);
+  }
+  bool is_visible(int winw, int winh) const {
+    Point2d p = get_position();
+    double r = get_entity_radius();
+    return (p.x >= -r && p.x <= winw+r && p.y >= -r && p.y <= winh+r);
+  }
+  //! attach \arg child, created after this entity, at \arg offset in the pixels of the texture
+  bool add_child(const Point2d & offset, const Entity & child) {
+    return _store->set_parent(child._id, _id, offset);
+  }
+  inline unsigned int get_nchildren() const {
+    unsigned int n = 0;
+    for (int c = hierarchy().first_child; c != EntityStore::NO_ENTITY;
+         c = _store->_hierarchy[c].next_sibling)
+      ++n;
+    return n;
+  }
+  inline Entity get_child(unsigned int i) const {
+    int c = hierarchy().first_child;
+    for (unsigned int j = 0; j < i; ++j)
+      c = _store->_hierarchy[c].next_sibling;
+    return Entity(_store, c);
+  }
+
+  inline Point2d offset2world_pos(const Point2d & p) const { return frame().to_world(p); }
+  inline Point2d world_pos2offset(const Point2d & p) const { return frame().to_offset(p); }
+  //! the offsets corresponding to a step of one pixel in world x and y
+  inline void world_steps2offset(Point2d & dx, Point2d & dy) const {
+    const Affine2d & to_offset = frame().to_offset;
+    dx = Point2d(to_offset.m00, to_offset.m10);
+    dy = Point2d(to_offset.m01, to_offset.m11);
+  }
+
+  inline void rough_bbox(SDL_Rect & bbox) const {
+    Point2d p = get_position();
+    double r = get_entity_radius();
+    bbox.x = p.x - r;
+    bbox.y = p.y - r;
+    bbox.w = 2 * r;
+    bbox.h = 2 * r;
+  }
+  inline void compute_tight_bbox_if_needed() const {
+    const Affine2d & to_world = frame().to_world; // may set tight_bbox_needed
+    EntityStore::Collision & c = collision();
+    if (!c.tight_bbox_needed)
+      return;
+    c.tight_bbox_needed = false;
+    int w = get_width(), h = get_height();
+    c.tight_bbox[0] = to_world(Point2d(0, 0));
+    c.tight_bbox[1] = to_world(Point2d(0, h));
+    c.tight_bbox[2] = to_world(Point2d(w, h));
+    c.tight_bbox[3] = to_world(Point2d(w, 0));
+  }
+
+  //! pixel-perfect collision, using the collision masks of the textures
+  inline bool collides_with(const Entity & other) {
+    TraceScope trace("Entity::collides_with");
+    // rough radius check
+    if ((get_position()-other.get_position()).norm()
+        > get_entity_radius() + other.get_entity_radius())
+      return false;
+    // tight bbox check, that gives the region where both pictures overlap
+    SDL_Rect inter;
+    if (!IsRectanglesIntersecting(get_tight_bbox(), other.get_tight_bbox(), &inter))
+      return false;
+    // http://www.sdltutorials.com/sdl-per-pixel-collision
+    const AlphaMask & mA = get_texture()->get_mask(), & mB = other.get_texture()->get_mask();
+    // the picture frames are affine functions of the world position:
+    // step along them instead of transforming each pixel
+    Point2d dAx, dAy, dBx, dBy;
+    world_steps2offset(dAx, dAy);
+    other.world_steps2offset(dBx, dBy);
+    Point2d A0 = world_pos2offset(Point2d(inter.x, inter.y)),
+        B0 = other.world_pos2offset(Point2d(inter.x, inter.y));
+    long npixels = 0; // tested in the pixel phase
+    for (int y = 0; y < inter.h; ++y) {
+      Point2d PA = A0 + y * dAy, PB = B0 + y * dBy;
+      // keep the part of the row inside both pictures
+      double tmin = 0, tmax = inter.w - 1;
+      if (!clip_span(PA.x, dAx.x, mA.get_width(), tmin, tmax)
+          || !clip_span(PA.y, dAx.y, mA.get_height(), tmin, tmax)
+          || !clip_span(PB.x, dBx.x, mB.get_width(), tmin, tmax)
+          || !clip_span(PB.y, dBx.y, mB.get_height(), tmin, tmax))
+        continue;
+      int t0 = ceil(tmin), t1 = floor(tmax);
+      if (t0 > t1)
+        continue;
+      PA += t0 * dAx;
+      PB += t0 * dBx;
+      int hit = mask_span_kernel()
+          (mA, to_mask_fixed(PA.x), to_mask_fixed(PA.y), to_mask_fixed(dAx.x), to_mask_fixed(dAx.y),
+           mB, to_mask_fixed(PB.x), to_mask_fixed(PB.y), to_mask_fixed(dBx.x), to_mask_fixed(dBx.y),
+           t1 - t0 + 1);
+      if (hit < 0) {
+        npixels += t1 - t0 + 1;
+        continue;
+      }
+      // matching pixel found
+      trace.set_arg("pixels", npixels + hit + 1);
+      collision().collision_pt = Point2d(inter.x + t0 + hit, inter.y + y);
+      return true;
+    } // end loop y
+    trace.set_arg("pixels", npixels);
+    collision().collision_pt = Point2d(-1, -1);
+    return false; // no matching pixel found
+  }
+
+  //! the corners of the texture in the world, after the rotation
+  inline const Point2d* get_tight_bbox() const {
+    compute_tight_bbox_if_needed();
+    return collision().tight_bbox;
+  }
+  //! the pixel of the last collision, x < 0 if none
+  inline Point2d get_collision_pt() const { return collision().collision_pt; }
+
+protected:
+  Entity(EntityStore* store, unsigned int id) : _store(store), _id(id) {}
+
+  // the components of the entity, valid until the next EntityStore::create()
+  inline EntityStore::Transform & transform() const { return _store->_transforms[_id]; }
+  inline EntityStore::Kinematics & kinematics() const { return _store->_kinematics[_id]; }
+  inline EntityStore::Sprite & sprite() const { return _store->_sprites[_id]; }
+  inline EntityStore::Collision & collision() const { return _store->_collisions[_id]; }
+  inline const EntityStore::Frame & frame() const { return _store->frame(_id); }
+  inline EntityStore::Hierarchy & hierarchy() const { return _store->_hierarchy[_id]; }
+
+  EntityStore* _store;
+  unsigned int _id;
+}; // end class Entity
+
+#endif // ENTITY_H
@@ -0,0 +1,110 @@
+/*!
+  \file        frame_arena.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+A linear allocator for the data that only lives during a frame.
+ */
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <string.h>
+#include <vector>
+
+/*! alloc() moves a pointer forward in a single block, and reset()
+  frees all the allocations of the frame at once.
+  When the block is full, the allocations go to the heap, and the block is
+  enlarged at the next reset() to hold all of the last frame:
+  once the largest frame was seen, nothing is allocated anymore.
+  Only for types without constructor nor destructor, that are not called.
+  Not thread-safe: one arena per thread.
+*/
+class FrameArena {
+public:
+  static const size_t ALIGNMENT = 16; //!< of all the allocations, enough for doubles and SSE
+
+  FrameArena() : _block(NULL), _capacity(0), _used(0), _overflow_bytes(0) {}
+  ~FrameArena() {
+    release_overflow();
+    delete[] _block;
+  }
+
+  //! make the block at least \arg capacity bytes. Frees the allocations of the frame.
+  void reserve(size_t capacity) {
+    release_overflow();
+    _used = 0;
+    if (capacity <= _capacity)
+      return;
+    delete[] _block;
+    _capacity = align(capacity);
+    _block = new char[_capacity];
+  }
+
+  //! \return uninitialized memory for \arg n objects, valid until reset()
+  template<class _T>
+  _T* alloc(size_t n) {
+    size_t bytes = align(n * sizeof(_T));
+    if (_used + bytes <= _capacity) {
+      char* ptr = _block + _used;
+      _used += bytes;
+      return (_T*) ptr;
+    }
+    // full: the block will be larger at the next reset()
+    _overflow_bytes += bytes;
+    _overflow.push_back(new char[bytes]);
+    return (_T*) _overflow.back();
+  }
+
+  //! \return \arg n objects set to zero, valid until reset()
+  template<class _T>
+  _T* alloc_zeroed(size_t n) {
+    _T* ptr = alloc<_T>(n);
+    memset(ptr, 0, n * sizeof(_T));
+    return ptr;
+  }
+
+  //! free all the allocations of the frame
+  void reset() {
+    size_t needed = _used + _overflow_bytes;
+    release_overflow();
+    _used = 0;
+    if (needed > _capacity)
+      reserve(needed + needed / 2);
+  }
+
+  inline size_t capacity() const { return _capacity; }
+  //! the bytes allocated since the last reset()
+  inline size_t used() const { return _used + _overflow_bytes; }
+
+private:
+  static inline size_t align(size_t bytes) {
+    return (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+  }
+
+  void release_overflow() {
+    for (unsigned int i = 0; i < _overflow.size(); ++i)
+      delete[] _overflow[i];
+    _overflow.clear();
+    _overflow_bytes = 0;
+  }
+
+  char* _block;
+  size_t _capacity, _used;
+  std::vector<char*> _overflow; //!< the allocations that did not fit in the block
+  size_t _overflow_bytes;
+}; // end class FrameArena
+
+#endif // FRAME_ARENA_H
@@ -0,0 +1,97 @@
+/*!
+  \file        glyph_cache.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+Text drawn from glyphs rasterized once, instead of a new texture per text.
+ */
+#ifndef GLYPH_CACHE_H
+#define GLYPH_CACHE_H
+
+#include "sprite_batch.h"
+#include "texture_atlas.h"
+
+/*! The printable ASCII characters of a font, rendered once in white
+  by build(), then packed with the other pictures by a TextureAtlas.
+  Texts are then drawn as one sprite per character, tinted by the batch:
+  changing a text allocates nothing and uploads nothing.
+*/
+class GlyphCache {
+public:
+  static const int FIRST_CHAR = 32, LAST_CHAR = 126;
+
+  GlyphCache() : _glyphs(LAST_CHAR - FIRST_CHAR + 1) {}
+
+  /*! rasterize the characters, without uploading them: they are added to
+   * \arg atlas, that must be built before drawing texts.
+   * \arg mode what the glyphs keep once in the atlas
+   */
+  bool build(TTF_Font* font, TextureAtlas & atlas, TextureMode mode = TEXTURE_KEEP_SURFACE) {
+    SDL_Color white = {255, 255, 255, 255};
+    char text[2] = {0, 0};
+    for (int c = FIRST_CHAR; c <= LAST_CHAR; ++c) {
+      text[0] = c;
+      SDL_Surface* surface = TTF_RenderText_Blended(font, text, white);
+      if (surface == NULL) {
+        printf( "Unable to render glyph '%c'! SDL_ttf Error: %s\n", c, TTF_GetError() );
+        return false;
+      }
+      Texture & glyph = _glyphs[c - FIRST_CHAR];
+      glyph.set_mode(mode);
+      glyph.from_surface(NULL, surface, 1, AlphaMask());
+      atlas.add(&glyph);
+    } // end loop c
+    return true;
+  }
+
+  //! the width of a text in pixels, characters out of the cache are skipped
+  int text_width(const char* text) const {
+    int width = 0;
+    for (const char* c = text; *c; ++c) {
+      if (has_glyph(*c))
+        width += glyph(*c).get_width();
+    }
+    return width;
+  }
+
+  //! add a text centered on \arg p, as Texture::render_center() would draw a rendered text
+  void add(SpriteBatch & batch, const char* text, const Point2d & p,
+           const SDL_Color & color, double scale = 1) const {
+    double x = p.x - .5 * scale * text_width(text);
+    for (const char* c = text; *c; ++c) {
+      if (!has_glyph(*c))
+        continue;
+      const Texture & g = glyph(*c);
+      batch.add(g, Point2d(x + .5 * scale * g.get_width(), p.y), scale, 0, color);
+      x += scale * g.get_width();
+    } // end loop c
+  }
+
+  void add_number(SpriteBatch & batch, int number, const Point2d & p,
+                  const SDL_Color & color, double scale = 1) const {
+    char text[16];
+    snprintf(text, sizeof(text), "%i", number);
+    add(batch, text, p, color, scale);
+  }
+
+private:
+  inline bool has_glyph(char c) const { return (c >= FIRST_CHAR && c <= LAST_CHAR); }
+  inline const Texture & glyph(char c) const { return _glyphs[c - FIRST_CHAR]; }
+
+  std::vector<Texture> _glyphs;
+}; // end class GlyphCache
+
+#endif // GLYPH_CACHE_H
@@ -0,0 +1,234 @@
+/*!
+  \file        job_system.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+A work-stealing scheduler for parallel loops over the entities.
+ */
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+//! the body of a parallel loop
+class RangeJob {
+public:
+  virtual ~RangeJob() {}
+  //! process the items [begin, end), that form the chunk number \arg chunk
+  virtual void run(unsigned int begin, unsigned int end, unsigned int chunk) = 0;
+}; // end class RangeJob
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*! parallel_for() cuts a loop into chunks, spread over one queue per thread.
+  Each thread takes the chunks of its own queue from the back,
+  and when it is empty, steals the ones of the other queues from the front.
+  The calling thread works too, and returns when all the chunks are done.
+
+  The chunks only depend on the number of items and on the chunk size,
+  not on the number of threads: a job writing its results per chunk,
+  then merged in the order of the chunks, gives the same output
+  whatever the number of threads and whoever runs each chunk.
+  Nothing is allocated after start().
+*/
+class JobSystem {
+public:
+  static const unsigned int MAX_CHUNKS = 4096; //!< per loop, bigger chunks beyond
+
+  JobSystem() : _stop(false), _generation(0), _mutex(NULL), _cond(NULL) {}
+  ~JobSystem() { stop(); }
+
+  //! \arg nthreads the number of threads, including the caller, by default one per core
+  void start(int nthreads = -1) {
+    stop();
+    if (nthreads <= 0)
+      nthreads = SDL_GetCPUCount();
+    _stop = false;
+    _mutex = SDL_CreateMutex();
+    _cond = SDL_CreateCond();
+    SDL_AtomicSet(&_pending, 0);
+    _queues.resize(nthreads);
+    for (int i = 0; i < nthreads; ++i)
+      _queues[i] = new Queue;
+    for (int i = 1; i < nthreads; ++i) {
+      Worker* worker = new Worker;
+      worker->system = this;
+      worker->queue = i;
+      worker->thread = SDL_CreateThread(work, "JobSystem", worker);
+      if (worker->thread == NULL) {
+        printf("JobSystem: could not create thread: '%s'\n", SDL_GetError());
+        delete worker;
+        break;
+      }
+      _workers.push_back(worker);
+    } // end loop i
+  }
+
+  void stop() {
+    if (_mutex == NULL)
+      return;
+    SDL_LockMutex(_mutex);
+    _stop = true;
+    SDL_CondBroadcast(_cond);
+    SDL_UnlockMutex(_mutex);
+    for (unsigned int i = 0; i < _workers.size(); ++i) {
+      SDL_WaitThread(_workers[i]->thread, NULL);
+      delete _workers[i];
+    }
+    _workers.clear();
+    for (unsigned int i = 0; i < _queues.size(); ++i)
+      delete _queues[i];
+    _queues.clear();
+    SDL_DestroyCond(_cond);
+    SDL_DestroyMutex(_mutex);
+    _mutex = NULL;
+    _cond = NULL;
+  }
+
+  //! the number of threads running the chunks, including the caller
+  inline unsigned int get_nthreads() const { return 1 + _workers.size(); }
+
+  //! the size of the chunks of a loop of \arg n items, at least \arg chunk_size
+  static inline unsigned int chunk_size(unsigned int n, unsigned int chunk_size) {
+    return std::max(chunk_size, (n + MAX_CHUNKS - 1) / MAX_CHUNKS);
+  }
+  //! the number of chunks of a loop of \arg n items, in [0, MAX_CHUNKS]
+  static inline unsigned int nchunks(unsigned int n, unsigned int min_chunk_size) {
+    unsigned int size = chunk_size(n, min_chunk_size);
+    return (n + size - 1) / size;
+  }
+
+  /*! run \arg job on the items [0, n), in chunks of \arg min_chunk_size items
+   * or more: see nchunks(). A single chunk is run by the caller right away,
+   * as when the system is not started.
+   */
+  void parallel_for(RangeJob & job, unsigned int n, unsigned int min_chunk_size) {
+    unsigned int size = chunk_size(n, min_chunk_size), nchunks = (n + size - 1) / size;
+    if (nchunks <= 1 || _workers.empty()) {
+      for (unsigned int c = 0; c < nchunks; ++c)
+        job.run(c * size, std::min(n, (c + 1) * size), c);
+      return;
+    }
+    // give each thread a contiguous block of chunks
+    unsigned int nthreads = _workers.size() + 1;
+    SDL_AtomicSet(&_pending, nchunks);
+    for (unsigned int q = 0; q < nthreads; ++q) {
+      Queue & queue = *_queues[q];
+      SDL_AtomicLock(&queue.lock);
+      for (unsigned int c = q * nchunks / nthreads; c < (q + 1) * nchunks / nthreads; ++c) {
+        Chunk & chunk = queue.chunks[queue.tail++];
+        chunk.job = &job;
+        chunk.begin = c * size;
+        chunk.end = std::min(n, (c + 1) * size);
+        chunk.index = c;
+      } // end loop c
+      SDL_AtomicUnlock(&queue.lock);
+    } // end loop q
+    SDL_LockMutex(_mutex);
+    ++_generation;
+    SDL_CondBroadcast(_cond);
+    SDL_UnlockMutex(_mutex);
+    // work with them, then wait for the chunks stolen by the others
+    run_chunks(0);
+    while (SDL_AtomicGet(&_pending) > 0)
+      run_chunks(0);
+  }
+
+private:
+  struct Chunk {
+    RangeJob* job;
+    unsigned int begin, end, index;
+  };
+  //! a ring of chunks: the owner pops at the back, the thieves at the front
+  struct Queue {
+    Queue() : lock(0), head(0), tail(0) {}
+    SDL_SpinLock lock;
+    unsigned int head, tail; // the chunks are [head, tail), tail <= MAX_CHUNKS
+    Chunk chunks[MAX_CHUNKS];
+  };
+  struct Worker {
+    JobSystem* system;
+    unsigned int queue;
+    SDL_Thread* thread;
+  };
+
+  bool pop_back(Queue & queue, Chunk & chunk) {
+    SDL_AtomicLock(&queue.lock);
+    bool ok = (queue.head < queue.tail);
+    if (ok)
+      chunk = queue.chunks[--queue.tail];
+    if (queue.head == queue.tail)
+      queue.head = queue.tail = 0;
+    SDL_AtomicUnlock(&queue.lock);
+    return ok;
+  }
+
+  bool steal_front(Queue & queue, Chunk & chunk) {
+    SDL_AtomicLock(&queue.lock);
+    bool ok = (queue.head < queue.tail);
+    if (ok)
+      chunk = queue.chunks[queue.head++];
+    if (queue.head == queue.tail)
+      queue.head = queue.tail = 0;
+    SDL_AtomicUnlock(&queue.lock);
+    return ok;
+  }
+
+  //! run the chunks of queue \arg q, then the ones of the other queues, until all are empty
+  void run_chunks(unsigned int q) {
+    Chunk chunk = Chunk();
+    unsigned int nqueues = _queues.size();
+    while (true) {
+      bool found = pop_back(*_queues[q], chunk);
+      for (unsigned int i = 1; i < nqueues && !found; ++i)
+        found = steal_front(*_queues[(q + i) % nqueues], chunk);
+      if (!found)
+        return;
+      chunk.job->run(chunk.begin, chunk.end, chunk.index);
+      SDL_AtomicAdd(&_pending, -1);
+    } // end while (true)
+  }
+
+  static int work(void* data) {
+    Worker* worker = (Worker*) data;
+    JobSystem* system = worker->system;
+    unsigned int generation = 0;
+    while (true) {
+      SDL_LockMutex(system->_mutex);
+      while (!system->_stop && system->_generation == generation)
+        SDL_CondWait(system->_cond, system->_mutex);
+      generation = system->_generation;
+      bool stop = system->_stop;
+      SDL_UnlockMutex(system->_mutex);
+      if (stop)
+        return 0;
+      system->run_chunks(worker->queue);
+    } // end while (true)
+  }
+
+  std::vector<Queue*> _queues; //!< _queues[0] is the one of the caller
+  std::vector<Worker*> _workers;
+  SDL_atomic_t _pending; //!< the chunks not finished yet
+  bool _stop;
+  unsigned int _generation; //!< incremented by each parallel_for()
+  SDL_mutex* _mutex;
+  SDL_cond* _cond;
+}; // end class JobSystem
+
+#endif // JOB_SYSTEM_H
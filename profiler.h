@@ -0,0 +1,204 @@
+/*!
+  \file        profiler.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+Time spent in each phase of a frame, with the statistics of the last frames,
+an overlay to draw them, and an export in CSV.
+ */
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <algorithm>
+#include "glyph_cache.h"
+
+/*! The phases of a frame are declared once with add_section(),
+  then timed with ProfileScope objects.
+  A section can be entered several times in a frame,
+  e.g. when several updates catch up with the clock: the times add up.
+  end_frame() stores the time of each section in a ring of the last
+  WINDOW frames, and writes it in the CSV file if any.
+  The simulation and the rendering can be timed by two threads,
+  as long as each section is timed by one of them:
+  a frame then holds the simulation ticks that ended during it, if any.
+  Nothing is allocated after the sections are declared.
+*/
+class FrameProfiler {
+public:
+  static const unsigned int WINDOW = 128; //!< the number of frames in the statistics
+
+  FrameProfiler() : _nframes(0), _csv(NULL), _lock(0) {}
+  ~FrameProfiler() { close_csv(); }
+
+  //! \arg depth the nesting level, for the indentation in the overlay
+  //! \return the id of the section, for ProfileScope
+  int add_section(const std::string & name, int depth = 0) {
+    Section s;
+    s.name = name;
+    s.depth = depth;
+    s.frame_ms = s.start = 0;
+    std::fill(s.ring, s.ring + WINDOW, 0);
+    _sections.push_back(s);
+    return _sections.size() - 1;
+  }
+
+  inline void begin(int section) { _sections[section].start = monotonic_seconds(); }
+  inline void end(int section) {
+    Section & s = _sections[section];
+    double ms = 1000 * (monotonic_seconds() - s.start);
+    SDL_AtomicLock(&_lock);
+    s.frame_ms += ms;
+    SDL_AtomicUnlock(&_lock);
+  }
+
+  //! store the times of the frame that just ended, and start a new one
+  void end_frame() {
+    unsigned int slot = _nframes % WINDOW;
+    SDL_AtomicLock(&_lock);
+    for (unsigned int i = 0; i < _sections.size(); ++i) {
+      Section & s = _sections[i];
+      s.ring[slot] = s.frame_ms;
+      s.frame_ms = 0;
+    }
+    SDL_AtomicUnlock(&_lock);
+    if (_csv != NULL) {
+      fprintf(_csv, "%lu", _nframes);
+      for (unsigned int i = 0; i < _sections.size(); ++i)
+        fprintf(_csv, ",%.4f", _sections[i].ring[slot]);
+      fprintf(_csv, "\n");
+    }
+    ++_nframes;
+  }
+
+  //! write a line per frame in \arg filename, with a column per section (milliseconds)
+  bool open_csv(const std::string & filename) {
+    close_csv();
+    _csv = fopen(filename.c_str(), "w");
+    if (_csv == NULL) {
+      printf("FrameProfiler: could not open '%s'\n", filename.c_str());
+      return false;
+    }
+    fprintf(_csv, "frame");
+    for (unsigned int i = 0; i < _sections.size(); ++i)
+      fprintf(_csv, ",%s_ms", _sections[i].name.c_str());
+    fprintf(_csv, "\n");
+    return true;
+  }
+  void close_csv() {
+    if (_csv != NULL)
+      fclose(_csv);
+    _csv = NULL;
+  }
+
+  inline unsigned int nsections() const { return _sections.size(); }
+  inline const std::string & name(int section) const { return _sections[section].name; }
+  inline int depth(int section) const { return _sections[section].depth; }
+
+  //! the statistics of a section over the last frames (milliseconds)
+  void stats(int section, double & mean, double & p99, double & max) const {
+    unsigned int n = std::min(_nframes, (unsigned long) WINDOW);
+    mean = p99 = max = 0;
+    if (n == 0)
+      return;
+    const float* ring = _sections[section].ring;
+    std::copy(ring, ring + n, _sorted);
+    unsigned int rank = .99 * (n - 1);
+    std::nth_element(_sorted, _sorted + rank, _sorted + n);
+    p99 = _sorted[rank];
+    for (unsigned int i = 0; i < n; ++i) {
+      mean += ring[i];
+      max = std::max(max, (double) ring[i]);
+    }
+    mean /= n;
+  }
+
+  //! print the statistics of all sections
+  void print_stats() const {
+    printf("Frame profile over the last %i frames (ms):\n",
+           (int) std::min(_nframes, (unsigned long) WINDOW));
+    for (unsigned int i = 0; i < _sections.size(); ++i) {
+      double mean, p99, max;
+      stats(i, mean, p99, max);
+      printf("  %*s%-*s mean %7.3f   p99 %7.3f   max %7.3f\n",
+             2 * depth(i), "", 20 - 2 * depth(i), name(i).c_str(), mean, p99, max);
+    }
+  }
+
+  /*! draw a line per section at (\arg x, \arg y): its name, its mean and p99
+   * times, and a bar of the mean time, full when it reaches \arg budget_ms.
+   * The text is added to \arg batch, that is flushed.
+   */
+  bool render(SDL_Renderer* renderer, SpriteBatch & batch, const GlyphCache & glyphs,
+              int x, int y, double budget_ms, double text_scale = .3) const {
+    static const int LINE = 16, TEXT_W = 230, BAR_W = 100;
+    SDL_Color white = {255, 255, 255, 255};
+    Uint8 r, g, b, a;
+    SDL_GetRenderDrawColor( renderer, &r, &g, &b, &a );
+    SDL_Rect back = { x, y, TEXT_W + BAR_W + 10, (int) _sections.size() * LINE + 4 };
+    SDL_SetRenderDrawColor( renderer, 0, 0, 0, 255 );
+    SDL_RenderFillRect( renderer, &back );
+    char text[64];
+    for (unsigned int i = 0; i < _sections.size(); ++i) {
+      double mean, p99, max;
+      stats(i, mean, p99, max);
+      int liney = y + 2 + i * LINE;
+      snprintf(text, sizeof(text), "%s %.2f %.2f", name(i).c_str(), mean, p99);
+      double textw = text_scale * glyphs.text_width(text);
+      glyphs.add(batch, text, Point2d(x + 4 + 10 * depth(i) + .5 * textw, liney + LINE / 2),
+                 white, text_scale);
+      SDL_Rect bar = { x + TEXT_W, liney + 2, (int) (BAR_W * std::min(1., mean / budget_ms)), LINE - 4 };
+      if (mean > budget_ms)
+        SDL_SetRenderDrawColor( renderer, 255, 0, 0, 255 );
+      else
+        SDL_SetRenderDrawColor( renderer, 0, 200, 0, 255 );
+      SDL_RenderFillRect( renderer, &bar );
+    } // end loop i
+    SDL_SetRenderDrawColor( renderer, r, g, b, a );
+    return batch.flush(renderer);
+  }
+
+private:
+  struct Section {
+    std::string name;
+    int depth;
+    double start, frame_ms;
+    float ring[WINDOW]; //!< the time of the last frames, indexed by frame % WINDOW
+  };
+
+  std::vector<Section> _sections;
+  unsigned long _nframes;
+  mutable float _sorted[WINDOW];
+  FILE* _csv;
+  SDL_SpinLock _lock; //!< between end() and end_frame()
+}; // end class FrameProfiler
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! times a section of a FrameProfiler, from its creation to the end of its scope
+class ProfileScope {
+public:
+  ProfileScope(FrameProfiler & profiler, int section)
+    : _profiler(profiler), _section(section) {
+    _profiler.begin(section);
+  }
+  ~ProfileScope() { _profiler.end(_section); }
+
+private:
+  FrameProfiler & _profiler;
+  int _section;
+}; // end class ProfileScope
+
+#endif // PROFILER_H
@@ -0,0 +1,365 @@
+/*!
+  \file        resample.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+Resampling of RGBA pictures with an area (box) filter:
+each destination pixel is the average of the source pixels it covers,
+weighted by the covered area, so that large downscales do not alias.
+The filter is separable: rows are first resampled horizontally,
+then accumulated vertically. The colors are averaged premultiplied
+by their alpha, so that transparent pixels do not darken the edges.
+The row kernels have scalar, SSE2 and AVX2 versions, selected at runtime,
+and the rows can be split into bands run by a thread pool.
+ */
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_cpuinfo.h>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "thread_pool.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RESAMPLE_KERNELS_X86 1
+#include <immintrin.h>
+#else
+#define RESAMPLE_KERNELS_X86 0
+#endif
+
+/*! the weights of the area filter along one axis:
+  destination pixel i is the sum of the n(i) source pixels from first(i),
+  weighted by weight(i, k), that sum to 1.
+*/
+class ResampleWeights {
+public:
+  void compute(int srcn, int dstn) {
+    double scale = 1. * srcn / dstn; // source pixels per destination pixel
+    _max_n = (int) ceil(scale) + 1;
+    _first.resize(dstn);
+    _n.resize(dstn);
+    _weights.assign(dstn * _max_n, 0);
+    for (int i = 0; i < dstn; ++i) {
+      double s0 = i * scale, s1 = std::min((i + 1) * scale, 1. * srcn);
+      int first = (int) floor(s0), last = std::min((int) ceil(s1), srcn) - 1;
+      _first[i] = first;
+      _n[i] = 0;
+      for (int j = first; j <= last; ++j) {
+        double overlap = std::min(s1, j + 1.) - std::max(s0, 1. * j);
+        if (overlap <= 1E-9) // empty border
+          continue;
+        if (_n[i] == 0)
+          _first[i] = j;
+        _weights[i * _max_n + _n[i]++] = overlap / scale;
+      } // end loop j
+    } // end loop i
+  }
+  inline int first(int i) const { return _first[i]; }
+  inline int n(int i) const { return _n[i]; }
+  inline const float* weights(int i) const { return &(_weights[i * _max_n]); }
+private:
+  int _max_n;
+  std::vector<int> _first, _n;
+  std::vector<float> _weights;
+}; // end class ResampleWeights
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*! The row kernels. All versions do the same float operations in the same
+  order, hence give the same results.
+  - hrow: resample a source row of straight RGBA bytes horizontally,
+    into premultiplied RGBA floats.
+  - axpy: acc[i] += w * row[i], on n floats.
+  - pack: convert premultiplied RGBA floats into RGBA bytes,
+    premultiplied or straight.
+*/
+typedef void (*ResampleHRow)(const Uint8* src, float* dst, const ResampleWeights & wx, int dstw);
+typedef void (*ResampleAxpy)(float* acc, const float* row, float w, int n);
+typedef void (*ResamplePack)(const float* src, Uint8* dst, int npixels, bool premultiplied);
+
+struct ResampleKernels {
+  ResampleHRow hrow;
+  ResampleAxpy axpy;
+  ResamplePack pack;
+};
+
+inline void resample_hrow_scalar(const Uint8* src, float* dst, const ResampleWeights & wx, int dstw) {
+  const float inv255 = 1.f / 255;
+  for (int x = 0; x < dstw; ++x, dst += 4) {
+    const Uint8* px = src + 4 * wx.first(x);
+    const float* w = wx.weights(x);
+    float acc[4] = {0, 0, 0, 0};
+    for (int k = 0; k < wx.n(x); ++k, px += 4) {
+      float a = px[3] * inv255;
+      for (unsigned int c = 0; c < 4; ++c)
+        acc[c] += (px[c] * (c < 3 ? a : 1.f)) * w[k];
+    } // end loop k
+    for (unsigned int c = 0; c < 4; ++c)
+      dst[c] = acc[c];
+  } // end loop x
+}
+
+inline void resample_axpy_scalar(float* acc, const float* row, float w, int n) {
+  for (int i = 0; i < n; ++i)
+    acc[i] += row[i] * w;
+}
+
+inline void resample_pack_scalar(const float* src, Uint8* dst, int npixels, bool premultiplied) {
+  for (int i = 0; i < npixels; ++i, src += 4, dst += 4) {
+    float a = src[3], f = (premultiplied || a <= 0 ? 1.f : 255.f / a);
+    for (unsigned int c = 0; c < 4; ++c) {
+      float v = (c < 3 ? src[c] * f : a);
+      dst[c] = (Uint8) lrintf(std::min(std::max(v, 0.f), 255.f));
+    }
+  } // end loop i
+}
+
+#if RESAMPLE_KERNELS_X86
+//! 4 bytes into 4 floats
+__attribute__((target("sse2")))
+inline __m128 resample_load_px_sse2(const Uint8* px) {
+  int bytes;
+  memcpy(&bytes, px, 4);
+  __m128i zero = _mm_setzero_si128(),
+      v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+}
+
+//! one pixel, that is 4 channels, per vector
+__attribute__((target("sse2")))
+inline void resample_hrow_sse2(const Uint8* src, float* dst, const ResampleWeights & wx, int dstw) {
+  const __m128 inv255 = _mm_set1_ps(1.f / 255),
+      rgb = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0)),
+      alpha_one = _mm_setr_ps(0, 0, 0, 1);
+  for (int x = 0; x < dstw; ++x, dst += 4) {
+    const Uint8* px = src + 4 * wx.first(x);
+    const float* w = wx.weights(x);
+    __m128 acc = _mm_setzero_ps();
+    for (int k = 0; k < wx.n(x); ++k, px += 4) {
+      __m128 v = resample_load_px_sse2(px),
+          a = _mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3)), inv255),
+          m = _mm_or_ps(_mm_and_ps(rgb, a), alpha_one); // (a, a, a, 1)
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_mul_ps(v, m), _mm_set1_ps(w[k])));
+    } // end loop k
+    _mm_storeu_ps(dst, acc);
+  } // end loop x
+}
+
+__attribute__((target("sse2")))
+inline void resample_axpy_sse2(float* acc, const float* row, float w, int n) {
+  __m128 vw = _mm_set1_ps(w);
+  int i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+                                      _mm_mul_ps(_mm_loadu_ps(row + i), vw)));
+  resample_axpy_scalar(acc + i, row + i, w, n - i);
+}
+
+__attribute__((target("sse2")))
+inline void resample_pack_sse2(const float* src, Uint8* dst, int npixels, bool premultiplied) {
+  const __m128 zero = _mm_setzero_ps(), v255 = _mm_set1_ps(255),
+      rgb = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+  for (int i = 0; i < npixels; ++i, src += 4, dst += 4) {
+    __m128 v = _mm_loadu_ps(src);
+    if (!premultiplied) {
+      __m128 a = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3)),
+          f = _mm_div_ps(v255, a),
+          positive = _mm_cmpgt_ps(a, zero),
+          unp = _mm_or_ps(_mm_and_ps(rgb, _mm_mul_ps(v, f)), _mm_andnot_ps(rgb, v));
+      v = _mm_or_ps(_mm_and_ps(positive, unp), _mm_andnot_ps(positive, v));
+    }
+    __m128i q = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, zero), v255));
+    q = _mm_packs_epi32(q, q);
+    int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(q, q));
+    memcpy(dst, &bytes, 4);
+  } // end loop i
+}
+
+//! the vertical pass is the bulk of the work: 8 floats per vector
+__attribute__((target("avx2")))
+inline void resample_axpy_avx2(float* acc, const float* row, float w, int n) {
+  __m256 vw = _mm256_set1_ps(w);
+  int i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i),
+                                            _mm256_mul_ps(_mm256_loadu_ps(row + i), vw)));
+  resample_axpy_scalar(acc + i, row + i, w, n - i);
+}
+#endif // RESAMPLE_KERNELS_X86
+
+////////////////////////////////////////////////////////////////////////////////
+
+enum ResampleKernelType {
+  RESAMPLE_KERNEL_SCALAR = 0,
+  RESAMPLE_KERNEL_SSE2   = 1,
+  RESAMPLE_KERNEL_AVX2   = 2,
+  NRESAMPLE_KERNELS      = 3
+};
+
+inline const char* resample_kernel_name(ResampleKernelType type) {
+  static const char* names[NRESAMPLE_KERNELS] = { "scalar", "sse2", "avx2" };
+  return names[type];
+}
+
+//! \return true if the CPU can run the kernels
+inline bool resample_kernel_supported(ResampleKernelType type) {
+#if RESAMPLE_KERNELS_X86
+  if (type == RESAMPLE_KERNEL_SSE2)
+    return SDL_HasSSE2();
+  if (type == RESAMPLE_KERNEL_AVX2)
+    return SDL_HasSSE2() && SDL_HasAVX2();
+#endif // RESAMPLE_KERNELS_X86
+  return (type == RESAMPLE_KERNEL_SCALAR);
+}
+
+//! the best kernels supported by the CPU
+inline ResampleKernelType best_resample_kernel() {
+  for (int type = NRESAMPLE_KERNELS - 1; type > RESAMPLE_KERNEL_SCALAR; --type) {
+    if (resample_kernel_supported((ResampleKernelType) type))
+      return (ResampleKernelType) type;
+  }
+  return RESAMPLE_KERNEL_SCALAR;
+}
+
+//! the kernels of a type. \pre the type is supported
+inline ResampleKernels resample_kernels(ResampleKernelType type) {
+  ResampleKernels k;
+  k.hrow = resample_hrow_scalar;
+  k.axpy = resample_axpy_scalar;
+  k.pack = resample_pack_scalar;
+#if RESAMPLE_KERNELS_X86
+  if (type >= RESAMPLE_KERNEL_SSE2) {
+    k.hrow = resample_hrow_sse2;
+    k.axpy = resample_axpy_sse2;
+    k.pack = resample_pack_sse2;
+  }
+  if (type == RESAMPLE_KERNEL_AVX2)
+    k.axpy = resample_axpy_avx2;
+#endif // RESAMPLE_KERNELS_X86
+  return k;
+}
+
+//! the kernels used by resample_surface(), the best supported ones by default
+inline ResampleKernels & resample_kernels() {
+  static ResampleKernels kernels = resample_kernels(best_resample_kernel());
+  return kernels;
+}
+
+//! force the kernels used by resample_surface()
+//! \return false if the CPU does not support them
+inline bool set_resample_kernel(ResampleKernelType type) {
+  if (!resample_kernel_supported(type))
+    return false;
+  resample_kernels() = resample_kernels(type);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*! resample the destination rows [y0, y1).
+  Each source row is resampled horizontally once,
+  then added to all the destination rows of the band it contributes to.
+*/
+inline void resample_band(const Uint8* src, int src_pitch, Uint8* dst, int dst_pitch, int dstw,
+                          const ResampleWeights & wx, const ResampleWeights & wy,
+                          int y0, int y1, bool premultiplied, const ResampleKernels & k) {
+  int stride = 4 * dstw;
+  std::vector<float> acc((y1 - y0) * stride, 0), hrow(stride);
+  int r0 = wy.first(y0), r1 = wy.first(y1 - 1) + wy.n(y1 - 1), ylo = y0;
+  for (int r = r0; r < r1; ++r) {
+    // the first destination row using r: the supports are sorted
+    while (ylo < y1 && wy.first(ylo) + wy.n(ylo) <= r)
+      ++ylo;
+    k.hrow(src + r * src_pitch, &(hrow[0]), wx, dstw);
+    for (int y = ylo; y < y1 && wy.first(y) <= r; ++y)
+      k.axpy(&(acc[(y - y0) * stride]), &(hrow[0]), wy.weights(y)[r - wy.first(y)], stride);
+  } // end loop r
+  for (int y = y0; y < y1; ++y)
+    k.pack(&(acc[(y - y0) * stride]), dst + y * dst_pitch, dstw, premultiplied);
+}
+
+class ResampleBandJob : public Job {
+public:
+  void run() {
+    resample_band(src, src_pitch, dst, dst_pitch, dstw, *wx, *wy, y0, y1, premultiplied, k);
+  }
+  const Uint8* src;
+  Uint8* dst;
+  int src_pitch, dst_pitch, dstw, y0, y1;
+  const ResampleWeights *wx, *wy;
+  bool premultiplied;
+  ResampleKernels k;
+}; // end class ResampleBandJob
+
+/*! resample a picture with an area filter.
+ * \param src any format, with straight alpha
+ * \param premultiplied if true, the colors of the result are premultiplied
+ *    by their alpha
+ * \param pool if not NULL, the rows are split into bands run by the pool.
+ *    Must not be called from a job of that pool, as it waits for the pool.
+ * \return a new SDL_PIXELFORMAT_RGBA32 surface, NULL if error
+ */
+SDL_Surface* resample_surface(SDL_Surface* src, int dstw, int dsth,
+                              bool premultiplied = false, ThreadPool* pool = NULL) {
+  if (src == NULL || dstw <= 0 || dsth <= 0)
+    return NULL;
+  SDL_Surface* rgba = SDL_ConvertSurfaceFormat(src, SDL_PIXELFORMAT_RGBA32, 0);
+  SDL_Surface* dst = SDL_CreateRGBSurfaceWithFormat(0, dstw, dsth, 32, SDL_PIXELFORMAT_RGBA32);
+  if (rgba == NULL || dst == NULL) {
+    printf("resample_surface(): could not create surfaces: '%s'\n", SDL_GetError());
+    SDL_FreeSurface(rgba);
+    SDL_FreeSurface(dst);
+    return NULL;
+  }
+  ResampleWeights wx, wy;
+  wx.compute(rgba->w, dstw);
+  wy.compute(rgba->h, dsth);
+  unsigned int nbands = (pool == NULL ? 1 : std::max(1u, 2 * pool->get_nthreads()));
+  nbands = std::min(nbands, (unsigned int) dsth);
+  std::vector<ResampleBandJob> jobs(nbands);
+  SDL_LockSurface(rgba);
+  SDL_LockSurface(dst);
+  for (unsigned int b = 0; b < nbands; ++b) {
+    ResampleBandJob & job = jobs[b];
+    job.src = (const Uint8*) rgba->pixels;
+    job.src_pitch = rgba->pitch;
+    job.dst = (Uint8*) dst->pixels;
+    job.dst_pitch = dst->pitch;
+    job.dstw = dstw;
+    job.y0 = b * dsth / nbands;
+    job.y1 = (b + 1) * dsth / nbands;
+    job.wx = &wx;
+    job.wy = &wy;
+    job.premultiplied = premultiplied;
+    job.k = resample_kernels();
+    if (pool == NULL)
+      job.run();
+    else
+      pool->push(&job);
+  } // end loop b
+  if (pool != NULL)
+    pool->wait();
+  SDL_UnlockSurface(dst);
+  SDL_UnlockSurface(rgba);
+  SDL_FreeSurface(rgba);
+  return dst;
+}
+
+#endif // RESAMPLE_H
@@ -0,0 +1,213 @@
+/*!
+  \file        resource_cache.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+A cache of the resources used several times, e.g. the pictures
+of two cars of the same model, or a font file opened at two sizes.
+ */
+#ifndef RESOURCE_CACHE_H
+#define RESOURCE_CACHE_H
+
+#include "asset_loader.h"
+#include <map>
+
+/*! Each resource is identified by its path and its scale,
+  and counts its users: acquire_*() gives the resource already loaded,
+  if any, and release() frees it after its last user.
+  The pictures and the sounds are decoded by an AssetLoader,
+  the fonts are opened from a single copy of their file.
+  Not thread-safe: to be used by the thread that loads the game.
+*/
+class ResourceCache {
+public:
+  ResourceCache() : _nacquired(0), _nhits(0) {}
+  //! \pre the resources are released, before quitting SDL
+  ~ResourceCache() {
+    if (!_resources.empty())
+      printf("ResourceCache: %i resources were not released\n", (int) _resources.size());
+  }
+
+  /*! a picture with the parameters of AssetLoader::add_texture(),
+   * queued in \arg loader if it is not in the cache yet:
+   * it can then only be used once \arg loader is finished.
+   * \param scale_of if not NULL, the picture of the cache
+   *    whose resize scale is used as goalscale
+   */
+  Texture* acquire_texture(AssetLoader & loader, const std::string & name,
+                           int goalwidth = -1, int goalheight = -1, double goalscale = -1,
+                           int mask_minalpha = 1, const Texture* scale_of = NULL) {
+    std::string key = "texture:"
+        + AssetBundle::key(name, goalwidth, goalheight, goalscale, mask_minalpha);
+    Resource* parent = (scale_of ? find(scale_of) : NULL);
+    if (parent != NULL)
+      key += " scaled as " + parent->key;
+    bool created;
+    Resource & r = acquire(key, created);
+    if (created) {
+      r.texture = new Texture();
+      r.job = loader.add_texture(r.texture, name, goalwidth, goalheight, goalscale,
+                                 mask_minalpha, (parent ? parent->job : -1));
+    }
+    return r.texture;
+  }
+
+  /*! a sound effect, queued in \arg loader if it is not in the cache yet.
+   * \arg chunk is set by finish_loading(), once \arg loader is finished.
+   */
+  void acquire_sound(AssetLoader & loader, const std::string & filename, Mix_Chunk** chunk) {
+    bool created;
+    Resource & r = acquire("sound:" + filename, created);
+    if (created)
+      loader.add_sound(&r.chunk, filename);
+    _pending_sounds.push_back(std::make_pair(chunk, &r.chunk));
+  }
+
+  //! set the sounds of acquire_sound(), once their loader is finished
+  void finish_loading() {
+    for (unsigned int i = 0; i < _pending_sounds.size(); ++i)
+      *(_pending_sounds[i].first) = *(_pending_sounds[i].second);
+    _pending_sounds.clear();
+  }
+
+  /*! a font of size \arg ptsize. All the sizes of a file share
+   * a single copy of it, read at the first acquisition.
+   * \return NULL if it could not be opened
+   */
+  TTF_Font* acquire_font(const std::string & filename, int ptsize) {
+    std::ostringstream key;
+    key << "font:" << filename << ':' << ptsize;
+    bool created;
+    Resource & r = acquire(key.str(), created);
+    if (!created)
+      return r.font;
+    Resource & file = acquire("file:" + filename, created);
+    if (created && !read_file(filename, file.data))
+      printf("ResourceCache: could not read '%s'\n", filename.c_str());
+    r.file_key = file.key;
+    if (!file.data.empty()) // the font closes the SDL_RWops, not the data
+      r.font = TTF_OpenFontRW(SDL_RWFromConstMem(&(file.data[0]), file.data.size()), 1, ptsize);
+    if (r.font == NULL) {
+      printf("Failed to load font '%s'! SDL_ttf Error: %s\n", filename.c_str(), TTF_GetError());
+      release_key(key.str());
+      return NULL;
+    }
+    return r.font;
+  }
+
+  //! release a resource of acquire_*(): it is freed after its last user. NULL is ignored.
+  void release(const void* resource) {
+    Resource* r = find(resource);
+    if (r != NULL)
+      release_key(r->key);
+  }
+
+  //! the memory of the resources, their CPU and GPU copies, in bytes
+  size_t resident_bytes() const {
+    size_t bytes = 0;
+    for (Map::const_iterator it = _resources.begin(); it != _resources.end(); ++it) {
+      const Resource & r = it->second;
+      if (r.texture)
+        bytes += r.texture->get_bytes();
+      if (r.chunk)
+        bytes += r.chunk->alen;
+      bytes += r.data.size();
+    } // end loop it
+    return bytes;
+  }
+
+  void print_stats() const {
+    printf("Resources: %i in memory, %i of %i acquisitions shared, %.2f MB resident\n",
+           (int) _resources.size(), _nhits, _nacquired, resident_bytes() / (1024. * 1024.));
+  }
+
+private:
+  struct Resource {
+    Resource() : nusers(0), texture(NULL), chunk(NULL), font(NULL), job(-1) {}
+    std::string key;
+    int nusers;
+    Texture* texture;
+    Mix_Chunk* chunk;
+    TTF_Font* font;
+    std::string file_key; //!< the file of a font
+    std::vector<char> data; //!< the content of a file
+    int job; //!< the id of a picture in its loader
+  };
+  typedef std::map<std::string, Resource> Map;
+
+  //! \arg created is true if the resource was not in the cache: it must then be loaded
+  Resource & acquire(const std::string & key, bool & created) {
+    ++_nacquired;
+    Map::iterator it = _resources.find(key);
+    created = (it == _resources.end());
+    if (!created) {
+      ++_nhits;
+      ++it->second.nusers;
+      return it->second;
+    }
+    Resource & r = _resources[key];
+    r.key = key;
+    r.nusers = 1;
+    return r;
+  }
+
+  Resource* find(const void* resource) {
+    if (resource == NULL)
+      return NULL;
+    for (Map::iterator it = _resources.begin(); it != _resources.end(); ++it) {
+      Resource & r = it->second;
+      if (resource == r.texture || resource == r.chunk || resource == r.font)
+        return &r;
+    } // end loop it
+    return NULL;
+  }
+
+  void release_key(const std::string & key) {
+    Map::iterator it = _resources.find(key);
+    if (it == _resources.end() || --it->second.nusers > 0)
+      return;
+    Resource & r = it->second;
+    delete r.texture;
+    Mix_FreeChunk_safe(r.chunk);
+    if (r.font)
+      TTF_CloseFont(r.font);
+    std::string file_key = r.file_key;
+    _resources.erase(it);
+    if (!file_key.empty())
+      release_key(file_key);
+  }
+
+  static bool read_file(const std::string & filename, std::vector<char> & data) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL)
+      return false;
+    fseek(file, 0, SEEK_END);
+    data.resize(std::max(0L, ftell(file)));
+    fseek(file, 0, SEEK_SET);
+    bool ok = (data.empty() || fread(&(data[0]), 1, data.size(), file) == data.size());
+    fclose(file);
+    if (!ok)
+      data.clear();
+    return ok;
+  }
+
+  Map _resources;
+  //! the destinations of acquire_sound(), and the sounds being loaded
+  std::vector< std::pair<Mix_Chunk**, Mix_Chunk**> > _pending_sounds;
+  int _nacquired, _nhits;
+}; // end class ResourceCache
+
+#endif // RESOURCE_CACHE_H
@@ -30,7 +30,11 @@ ________________________________________________________________________________
 #include <SDL2/SDL2_gfxPrimitives.h>
 #include <SDL2/SDL_ttf.h>
 #include <SDL_mixer.h>
+#include "alpha_mask.h"
+#include "resample.h"
 #include "timer.h"
+#include "trace.h"
+#include <algorithm>
 #include <sstream>
 #include <vector>
 
@@ -160,6 +164,46 @@ inline Point2d rotate(const Point2d &pt, double angle) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+//! a 2x3 affine transform: p -> M p + t, with M = [m00 m01 ; m10 m11]
+struct Affine2d {
+  double m00, m01, m10, m11, tx, ty;
+
+  //! the transform of a point
+  inline Point2d operator() (const Point2d & p) const {
+    return Point2d(m00 * p.x + m01 * p.y + tx, m10 * p.x + m11 * p.y + ty);
+  }
+  //! the transform of a vector, without the translation
+  inline Point2d linear(const Point2d & v) const {
+    return Point2d(m00 * v.x + m01 * v.y, m10 * v.x + m11 * v.y);
+  }
+
+  /*! scale by \arg scale around \arg center, rotate by the angle of cosine
+   * \arg cosa and sine \arg sina, then move \arg center to \arg origin
+   */
+  static Affine2d similarity(double cosa, double sina, double scale,
+                             const Point2d & center, const Point2d & origin) {
+    Affine2d a;
+    a.m00 = scale * cosa;  a.m01 = -scale * sina;
+    a.m10 = scale * sina;  a.m11 = scale * cosa;
+    a.tx = origin.x - (a.m00 * center.x + a.m01 * center.y);
+    a.ty = origin.y - (a.m10 * center.x + a.m11 * center.y);
+    return a;
+  }
+
+  //! \pre M is invertible
+  Affine2d inverse() const {
+    double idet = 1. / (m00 * m11 - m01 * m10);
+    Affine2d a;
+    a.m00 = m11 * idet;   a.m01 = -m01 * idet;
+    a.m10 = -m10 * idet;  a.m11 = m00 * idet;
+    a.tx = -(a.m00 * tx + a.m01 * ty);
+    a.ty = -(a.m10 * tx + a.m11 * ty);
+    return a;
+  }
+}; // end struct Affine2d
+
+////////////////////////////////////////////////////////////////////////////////
+
 /*!
  * \brief   detect if a point is inside a polygon - return true or false
  *  http://en.wikipedia.org/wiki/Point_in_polygon#Winding_number_algorithm
@@ -202,48 +246,78 @@ static inline bool point_inside_polygon(const Point2d & p,
 
 ////////////////////////////////////////////////////////////////////////////////
 
-/*! https://stackoverflow.com/questions/10962379/how-to-check-intersection-between-2-rotated-rectangles
- * Checks if the two polygons are intersecting.
- * \param reverse_already_checked
- *  the function is internally made of 2 subcalls.
- *  DO NOT set this parameter to true.
- */
-bool IsPolygonsIntersecting(const std::vector<Point2d> & A,
-                            const std::vector<Point2d> & B,
-                            bool reverse_already_checked = false) {
-  unsigned int sA =A.size(), sB = B.size();
-  for (unsigned int i1 = 0; i1 <sA; i1++) {
-    unsigned int i2 = (i1 + 1) %sA;
-    Point2d p1 = A[i1], p2 = A[i2];
-    Point2d normal(p2.y - p1.y, p1.x - p2.x);
-
-    double UNDEF = 1E9;
-    double minA = UNDEF, maxA = UNDEF;
-    for (unsigned int i = 0; i <sA; ++i) {
-      Point2d p = A[i];
-      double projected = normal.x * p.x + normal.y * p.y;
-      if (minA == UNDEF || projected < minA)
-        minA = projected;
-      if (maxA == UNDEF || projected > maxA)
-        maxA = projected;
-    }
-
-    double minB = UNDEF, maxB = UNDEF;
-    for (unsigned int i = 0; i < sB; ++i) {
-      Point2d p = B[i];
-      double projected = normal.x * p.x + normal.y * p.y;
-      if (minB == UNDEF || projected < minB)
-        minB = projected;
-      if (maxB == UNDEF || projected > maxB)
-        maxB = projected;
-    }
+//! \return true if \arg axis separates the projections of the rectangle \arg A and of \arg B
+static inline bool rectangle_axis_separates(const Point2d* A, const Point2d* B,
+                                            const Point2d & axis) {
+  // the other edge of A is orthogonal to the axis: 2 corners give its projection
+  double a0 = axis.dot(A[0]), a1 = axis.dot(A[2]);
+  double minA = std::min(a0, a1), maxA = std::max(a0, a1);
+  double minB = axis.dot(B[0]), maxB = minB;
+  for (unsigned int i = 1; i < 4; ++i) {
+    double proj = axis.dot(B[i]);
+    minB = std::min(minB, proj);
+    maxB = std::max(maxB, proj);
+  } // end loop i
+  return (maxA < minB || maxB < minA);
+}
 
-    if (maxA < minB || maxB < minA)
-      return false;
-  }
-  if (!reverse_already_checked)
+/*! the separating axis test for two rectangles, e.g. the tight bounding boxes
+ * of the entities, given by their 4 corners in order: only the directions of
+ * two edges of each rectangle need to be checked.
+ * https://stackoverflow.com/questions/10962379/how-to-check-intersection-between-2-rotated-rectangles
+ * \param overlap
+ *   if not NULL and the rectangles intersect, filled with the bounding box
+ *   of their intersection, enlarged to the pixels
+ * \return true if the rectangles are intersecting
+ */
+inline bool IsRectanglesIntersecting(const Point2d* A, const Point2d* B,
+                                     SDL_Rect* overlap = NULL) {
+  if (rectangle_axis_separates(A, B, A[1] - A[0])
+      || rectangle_axis_separates(A, B, A[3] - A[0])
+      || rectangle_axis_separates(B, A, B[1] - B[0])
+      || rectangle_axis_separates(B, A, B[3] - B[0]))
+    return false;
+  if (overlap == NULL)
+    return true;
+  // clip A by the 4 edges of B (Sutherland-Hodgman): at most 8 corners
+  Point2d buffers[2][8];
+  Point2d *in = buffers[0], *out = buffers[1];
+  unsigned int nin = 4;
+  std::copy(A, A + 4, in);
+  Point2d e0 = B[1] - B[0], e1 = B[2] - B[1];
+  double orient = (e0.x * e1.y - e0.y * e1.x >= 0 ? 1 : -1); // the inside of B is on the left
+  for (unsigned int edge = 0; edge < 4 && nin > 0; ++edge) {
+    const Point2d & p1 = B[edge], & p2 = B[(edge + 1) % 4];
+    Point2d normal(orient * (p1.y - p2.y), orient * (p2.x - p1.x)); // inwards
+    double offset = normal.dot(p1);
+    unsigned int nout = 0;
+    for (unsigned int i = 0; i < nin; ++i) {
+      const Point2d & c = in[i], & n = in[(i + 1) % nin];
+      double dc = normal.dot(c) - offset, dn = normal.dot(n) - offset;
+      if (dc >= 0)
+        out[nout++] = c;
+      if ((dc >= 0) != (dn >= 0)) // the side crosses the edge
+        out[nout++] = c + (dc / (dc - dn)) * (n - c);
+    } // end loop i
+    std::swap(in, out);
+    nin = nout;
+  } // end loop edge
+  if (nin == 0) { // only touching
+    overlap->w = overlap->h = 0;
     return true;
-  return IsPolygonsIntersecting(B, A, false);
+  }
+  double xmin = in[0].x, xmax = in[0].x, ymin = in[0].y, ymax = in[0].y;
+  for (unsigned int i = 1; i < nin; ++i) {
+    xmin = std::min(xmin, in[i].x);
+    xmax = std::max(xmax, in[i].x);
+    ymin = std::min(ymin, in[i].y);
+    ymax = std::max(ymax, in[i].y);
+  } // end loop i
+  overlap->x = floor(xmin);
+  overlap->y = floor(ymin);
+  overlap->w = (int) ceil(xmax) - overlap->x + 1;
+  overlap->h = (int) ceil(ymax) - overlap->y + 1;
+  return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -312,6 +386,7 @@ void putpixel(SDL_Surface *surface, int x, int y, Uint32 pixel) {
 }
 
 // http://www.sdltutorials.com/sdl-scale-surface
+//! nearest neighbour scaling, kept for reference: see resample_surface()
 SDL_Surface *ScaleSurface(SDL_Surface *Surface, Uint16 Width, Uint16 Height)
 {
   if(!Surface || !Width || !Height)
@@ -420,6 +495,24 @@ inline bool render_arrow
 
 ////////////////////////////////////////////////////////////////////////////////
 
+/*! restrict the interval [tmin, tmax] to the values of t such as
+ * c0 + t * d is in [0, L).
+ * \return false if the resulting interval is empty
+ */
+inline bool clip_span(double c0, double d, double L, double & tmin, double & tmax) {
+  static const double EPS = 1E-6; // to stay inside despite rounding errors
+  if (fabs(d) < 1E-9)
+    return (c0 >= 0 && c0 < L - EPS && tmin <= tmax);
+  double t0 = -c0 / d, t1 = (L - c0) / d;
+  if (d < 0)
+    std::swap(t0, t1);
+  tmin = std::max(tmin, t0 + EPS);
+  tmax = std::min(tmax, t1 - EPS);
+  return tmin <= tmax;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 inline void Mix_FreeChunk_safe(Mix_Chunk * & chunk) {
   if (chunk)
     Mix_FreeChunk(chunk);
@@ -428,9 +521,56 @@ inline void Mix_FreeChunk_safe(Mix_Chunk * & chunk) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+/*! set the blend mode of a texture whose colors are, or not,
+ * premultiplied by their alpha.
+ * \return false if the renderer does not support premultiplied colors
+ */
+inline bool set_blend_mode(SDL_Texture* tex, bool premultiplied) {
+  if (!premultiplied)
+    return (SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND) == 0);
+#if SDL_VERSION_ATLEAST(2, 0, 6)
+  SDL_BlendMode mode = SDL_ComposeCustomBlendMode
+      (SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+       SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+  return (SDL_SetTextureBlendMode(tex, mode) == 0);
+#else // no custom blend modes
+  return false;
+#endif
+}
+
+//! divide the colors of a RGBA32 surface by their alpha, in place
+void unpremultiply_surface(SDL_Surface* surface) {
+  SDL_LockSurface(surface);
+  for (int y = 0; y < surface->h; ++y) {
+    Uint8* px = (Uint8*) surface->pixels + y * surface->pitch;
+    for (int x = 0; x < surface->w; ++x, px += 4) {
+      if (px[3] == 0 || px[3] == 255)
+        continue;
+      for (unsigned int c = 0; c < 3; ++c)
+        px[c] = std::min(255, (255 * px[c] + px[3] / 2) / px[3]);
+    } // end loop x
+  } // end loop y
+  SDL_UnlockSurface(surface);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! what a Texture keeps in memory once uploaded, see Texture::set_mode()
+enum TextureMode {
+  TEXTURE_KEEP_SURFACE = 0, //!< the pixels, e.g. to bake or to blit them again
+  TEXTURE_COLLISION    = 1, //!< only the collision mask
+  TEXTURE_DRAW_ONLY    = 2  //!< neither the pixels nor the mask
+};
+
 class Texture {
 public:
-  Texture() { _sdltex = NULL; _sdlsurface = NULL; _width =  _height = 0; _resize_scale = 1; }
+  Texture() {
+    _sdltex = NULL; _sdlsurface = NULL; _width =  _height = 0; _resize_scale = 1;
+    _premultiplied = false;
+    _mode = TEXTURE_KEEP_SURFACE;
+    _in_atlas = false;
+    set_uv(0, 0, 1, 1);
+  }
   ~Texture() { free(); }
 
   void free() {
@@ -439,12 +579,16 @@ public:
     DEBUG_PRINT("Texture::free(%ix%i)\n", _width, _height);
     _width =  _height = 0;
     _resize_scale = 1;
-    //Free texture if it exists
-    if (_sdltex != NULL)
+    //Free texture if it exists - the pages of an atlas belong to it
+    if (_sdltex != NULL && !_in_atlas)
       SDL_DestroyTexture( _sdltex );
     if (_sdlsurface != NULL)
       SDL_FreeSurface( _sdlsurface );
     _sdltex = NULL;
+    _premultiplied = false;
+    _in_atlas = false;
+    set_uv(0, 0, 1, 1);
+    _mask.clear();
   } // end free()
 
   //////////////////////////////////////////////////////////////////////////////
@@ -452,13 +596,78 @@ public:
   inline int get_width() const { return _width;}
   inline int get_height() const { return _height;}
   inline double get_resize_scale() const { return _resize_scale;}
+  //! true if the colors of the pixels are premultiplied by their alpha
+  inline bool is_premultiplied() const { return _premultiplied;}
+  inline SDL_Texture* get_sdl_texture() const { return _sdltex;}
+  inline SDL_Surface* get_sdl_surface() const { return _sdlsurface;}
   inline Point2d center() const  { return Point2d(get_width()/2, get_height()/2); }
+  //! the memory of the surface, of the mask and of the SDL_Texture if not in an atlas
+  size_t get_bytes() const {
+    size_t bytes = _mask.get_bytes();
+    if (_sdlsurface != NULL)
+      bytes += _sdlsurface->pitch * _sdlsurface->h;
+    if (_sdltex != NULL && !_in_atlas)
+      bytes += 4 * _width * _height;
+    return bytes;
+  }
 
   //////////////////////////////////////////////////////////////////////////////
 
+  /*! make the texture a view on a sub-rectangle of an atlas page.
+   * Its own SDL_Texture is destroyed, the page belongs to the atlas.
+   * \param rect the position of the picture in the page, in pixels
+   */
+  void set_atlas_view(SDL_Texture* page, int pagew, int pageh, const SDL_Rect & rect) {
+    if (_sdltex != NULL && !_in_atlas)
+      SDL_DestroyTexture( _sdltex );
+    _sdltex = page;
+    _in_atlas = true;
+    _atlas_rect = rect;
+    set_uv(1. * rect.x / pagew, 1. * rect.y / pageh,
+           1. * (rect.x + rect.w) / pagew, 1. * (rect.y + rect.h) / pageh);
+  }
+  inline bool in_atlas() const { return _in_atlas; }
+
+  //! what is kept once uploaded, from the next upload. Not changed by free().
+  inline void set_mode(TextureMode mode) { _mode = mode; }
+  inline TextureMode get_mode() const { return _mode; }
+
+  /*! free what the mode does not keep, once the pixels are on the GPU,
+   * i.e. after upload() or in an atlas, or when nothing will be drawn.
+   * The size, the resize scale and the view in an atlas are kept.
+   */
+  void release_surface() {
+    if (_mode == TEXTURE_KEEP_SURFACE)
+      return;
+    if (_sdlsurface != NULL)
+      SDL_FreeSurface( _sdlsurface );
+    _sdlsurface = NULL;
+    if (_mode == TEXTURE_DRAW_ONLY)
+      _mask.clear();
+  }
+  //! the texture coordinates of the picture in its SDL_Texture, in [0, 1]
+  inline void get_uv(float & u0, float & v0, float & u1, float & v1) const {
+    u0 = _uv[0]; v0 = _uv[1]; u1 = _uv[2]; v1 = _uv[3];
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+
+  //! \arg mask_minalpha the alpha threshold of the collision mask
   bool from_file(SDL_Renderer* renderer, const std::string &str,
-                 int goalwidth = -1, int goalheight = -1, double goalscale = -1) {
-    DEBUG_PRINT("Texture::from_file('%s'), goal:(%i, %i, %g)\n", str.c_str(), goalwidth, goalheight, goalscale);
+                 int goalwidth = -1, int goalheight = -1, double goalscale = -1,
+                 int mask_minalpha = 1) {
+    return decode_file(str, goalwidth, goalheight, goalscale, mask_minalpha)
+        && upload(renderer, str);
+  }// end from_file()
+
+  /*! the CPU part of from_file(): load, scale and mask the picture,
+   * without creating the SDL_Texture. Can be called from any thread.
+   */
+  bool decode_file(const std::string &str,
+                   int goalwidth = -1, int goalheight = -1, double goalscale = -1,
+                   int mask_minalpha = 1) {
+    DEBUG_PRINT("Texture::decode_file('%s'), goal:(%i, %i, %g)\n", str.c_str(), goalwidth, goalheight, goalscale);
+    TraceScope trace("Texture::decode_file");
     free();
     // Load image as SDL_Surface
     _sdlsurface = IMG_Load( str.c_str() );
@@ -474,23 +683,73 @@ public:
       double scaley =  (goalheight > 0 ? 1. * goalheight / _sdlsurface->h : 1E6);
       double scalescale =  (goalscale > 0 ? goalscale : 1E6);
       _resize_scale = std::min(scalescale, std::min(scalex, scaley));
-      SDL_Surface* surface_scaled = ScaleSurface(_sdlsurface, _resize_scale * _sdlsurface->w, _resize_scale * _sdlsurface->h);
+      SDL_Surface* surface_scaled = resample_surface
+          (_sdlsurface, std::max(1, (int) (_resize_scale * _sdlsurface->w)),
+           std::max(1, (int) (_resize_scale * _sdlsurface->h)));
+      if (surface_scaled == NULL) {
+        printf( "Unable to scale image %s!\n", str.c_str() );
+        SDL_FreeSurface( _sdlsurface );
+        _sdlsurface = NULL;
+        return false;
+      }
       SDL_FreeSurface( _sdlsurface );
       _sdlsurface = surface_scaled;
     }
 
+    //Get image dimensions
+    _width = _sdlsurface->w;
+    _height = _sdlsurface->h;
+    _mask.from_surface(_sdlsurface, mask_minalpha);
+    return true;
+  }// end decode_file()
+
+  //////////////////////////////////////////////////////////////////////////////
+
+  //! create the SDL_Texture from the surface, if not done yet.
+  //! Must be called from the rendering thread.
+  bool upload(SDL_Renderer* renderer, const std::string & name = "") {
+    // no renderer, e.g. headless or decoding in a worker: nothing to upload yet
+    if (renderer == NULL || _sdltex != NULL || _sdlsurface == NULL)
+      return true;
     // SDL_Surface is just the raw pixels
     // Convert it to a hardware-optimzed texture so we can render it
     _sdltex = SDL_CreateTextureFromSurface( renderer, _sdlsurface );
     if (_sdltex == NULL) {
-      printf("Could not load texture '%s':'%s'\n", str.c_str(), SDL_GetError());
+      printf("Could not load texture '%s':'%s'\n", name.c_str(), SDL_GetError());
       return false;
     }
-    //Get image dimensions
+    if (!_premultiplied || set_blend_mode(_sdltex, true)) {
+      release_surface();
+      return true;
+    }
+    // the renderer does not know premultiplied colors: go back to straight ones
+    SDL_DestroyTexture( _sdltex );
+    _sdltex = NULL;
+    unpremultiply_surface(_sdlsurface);
+    _premultiplied = false;
+    return upload(renderer, name);
+  } // end upload()
+
+  //////////////////////////////////////////////////////////////////////////////
+
+  /*! use an already scaled picture, e.g. from an asset bundle.
+   * \param surface the pixels, the texture takes its ownership.
+   *    If premultiplied, it must be in SDL_PIXELFORMAT_RGBA32.
+   * \param mask its collision mask
+   */
+  bool from_surface(SDL_Renderer* renderer, SDL_Surface* surface,
+                    double resize_scale, const AlphaMask & mask,
+                    bool premultiplied = false, const std::string & name = "") {
+    DEBUG_PRINT("Texture::from_surface('%s')\n", name.c_str());
+    free();
+    _sdlsurface = surface;
     _width = _sdlsurface->w;
     _height = _sdlsurface->h;
-    return true;
-  }// end from_file()
+    _resize_scale = resize_scale;
+    _premultiplied = premultiplied;
+    _mask = mask;
+    return upload(renderer, name);
+  }// end from_surface()
 
   //////////////////////////////////////////////////////////////////////////////
 
@@ -522,6 +781,7 @@ public:
     //Get image dimensions
     _width = _sdlsurface->w;
     _height = _sdlsurface->h;
+    release_surface();
     return true;
   }
 
@@ -540,6 +800,20 @@ public:
       renderQuad.w = scale * clip->w;
       renderQuad.h = scale * clip->h;
     }
+    // in an atlas, the clip is relative to the picture sub-rectangle
+    SDL_Rect atlas_clip;
+    if (_in_atlas) {
+      if (clip != NULL)
+        atlas_clip = *clip;
+      else {
+        atlas_clip.x = atlas_clip.y = 0;
+        atlas_clip.w = _width;
+        atlas_clip.h = _height;
+      }
+      atlas_clip.x += _atlas_rect.x;
+      atlas_clip.y += _atlas_rect.y;
+      clip = &atlas_clip;
+    }
     //Render to screen
     if (flip == SDL_FLIP_NONE && fabs(angle_rad) < 1E-2) {
       bool ok = (SDL_RenderCopy( renderer, _sdltex, clip, &renderQuad ) == 0);
@@ -565,17 +839,23 @@ public:
   //////////////////////////////////////////////////////////////////////////////
 
   // http://www.sdltutorials.com/sdl-per-pixel-collision
-  //! \return alpha in [0, 255], or < 0 if out of bounds
+  //! \return alpha in [0, 255], or < 0 if out of bounds.
+  //! Without surface, 255 or 0 from the collision mask.
   inline int get_alpha(const Point2d & p) const {
     if (p.x < 0 || p.x >= get_width()
         || p.y < 0 || p.y >= get_height())
       return -1;
+    if (_sdlsurface == NULL)
+      return (_mask.get_width() > 0 && _mask.get(p.x, p.y) ? 255 : 0);
     Uint8 red, green, blue, alpha;
     SDL_GetRGBA(getpixel(_sdlsurface, p.x, p.y),
                 _sdlsurface->format, &red, &green, &blue, &alpha);
     return alpha;
   }
 
+  //! the collision mask, built by from_file()
+  inline const AlphaMask & get_mask() const { return _mask; }
+
 private:
   //The actual hardware texture
   SDL_Texture* _sdltex;
@@ -583,208 +863,17 @@ private:
   //Image dimensions
   int _width, _height;
   double _resize_scale;
+  bool _premultiplied;
+  TextureMode _mode;
+  AlphaMask _mask;
+  // atlas stuff
+  inline void set_uv(float u0, float v0, float u1, float v1) {
+    _uv[0] = u0; _uv[1] = v0; _uv[2] = u1; _uv[3] = v1;
+  }
+  bool _in_atlas;
+  SDL_Rect _atlas_rect;
+  float _uv[4];
 }; // end Texture
 
-////////////////////////////////////////////////////////////////////////////////
-
-class Entity {
-public:
-  Entity() {
-    _tex_ptr = NULL;
-    _bbox_offset.resize(4);
-    _tex_radius = _entity_radius = _angle = _angspeed = 0;
-    _rendering_scale  = 1;
-    _compute_tight_bbox_needed = true;
-    _collision_pt = Point2d(-1, -1);
-    set_position(Point2d(0, 0));
-  }
-
-  double get_update_timer() const               { return  _update_timer.getTimeSeconds(); }
-  double get_life_timer()   const               { return  _life_timer.getTimeSeconds(); }
-  void set_angle(const double & angle)          { _angle = angle; }
-  double get_angle() const                      { return  _angle; }
-  void set_angspeed(const double & angspeed)    { _angspeed = angspeed; }
-  double get_angspeed() const                   { return  _angspeed; }
-  void increase_angle(const double & dangle)    {
-    _compute_tight_bbox_needed = true;
-    _angle += dangle;
-  }
-  void set_accel(const Point2d & accel)         { _accel = accel; }
-  void renorm_accel(const double & newnorm)     { _accel.renorm(newnorm); }
-  Point2d get_accel() const                     { return  _accel; }
-  void set_speed(const Point2d & speed)         { _speed = speed; }
-  void renorm_speed(const double & newnorm)     { _speed.renorm(newnorm); }
-  Point2d get_speed() const                     { return  _speed; }
-  void set_tan_nor_speed(const Point2d & speed) { _speed = rotate(speed, _angle); }
-  void set_position(const Point2d & position)   {
-    _compute_tight_bbox_needed = true;
-    _position = position;
-    update_children_positions();
-  }
-  Point2d get_position() const                  { return  _position; }
-  void advance(const double & dist) {
-    set_position(_position + rotate(Point2d(dist, 0), _angle));
-  }
-  void rotate_towards_speed_direction() {
-    if (fabs(_speed.y)>1E-2)
-      _angle = atan2(_speed.y, _speed.x);
-  }
-  void update_pos_speed() {
-    Timer::Time time = _update_timer.getTimeSeconds();
-    _compute_tight_bbox_needed = true;
-    _angle += time * _angspeed;
-    _speed += time * _accel;
-    _position += time * _speed;
-    // update children
-    for (unsigned int i = 0; i < _children.size(); ++i)
-      _children[i].second.update_pos_speed();
-    update_children_positions();
-    _update_timer.reset();
-  }
-
-  bool set_texture(Texture* texture) {
-    _tex_ptr = texture;
-    _tex_radius = hypot(get_width(), get_height()) / 2;
-    _entity_radius = _tex_radius * _rendering_scale;
-    _bbox_offset[0] = Point2d(0, 0);
-    _bbox_offset[1] = Point2d(0, get_height());
-    _bbox_offset[2] = Point2d(get_width(), get_height());
-    _bbox_offset[3] = Point2d(get_width(), 0);
-    _compute_tight_bbox_needed = true;
-    return true;
-  } // end from_file()
-  Texture* get_texture() const { return _tex_ptr; }
-
-  void set_rendering_scale(const double & rendering_scale) {
-    _rendering_scale = rendering_scale;
-    _entity_radius = _tex_radius * _rendering_scale;
-  }
-  double get_rendering_scale() const                     { return  _rendering_scale; }
-  double get_entity_radius()   const                     { return  _entity_radius; }
-  inline int get_width() const {
-    return ( _tex_ptr  ? _tex_ptr->get_width() : -1);
-  }
-  inline int get_height() const {
-    return (_tex_ptr  ? _tex_ptr->get_height() : -1);
-  }
-  bool is_visible(int winw, int winh) {
-    return (_position.x >= -_entity_radius
-            && _position.x <= winw+_entity_radius
-            && _position.y >= -_entity_radius
-            && _position.y <= winh+_entity_radius);
-  }
-  void add_child(const Point2d & offset, const Entity & child) {
-    _children.push_back(std::make_pair(offset, child));
-  }
-
-  bool render(SDL_Renderer* renderer) {
-    if (!_tex_ptr) {
-      printf("Entity::render() failed : no texture set\n");
-      return false;
-    }
-    if (!_tex_ptr->render_center(renderer, _position, _rendering_scale, NULL, _angle)) {
-      printf("Entity::render() failed : tex_ptr->render_center() failed.\n");
-      return false;
-    }
-    bool ok = true;
-    for (unsigned int i = 0; i < _children.size(); ++i)
-      ok = ok && _children[i].second.render(renderer);
-#if DEBUG
-    //render_point(renderer, _position, 3, 255, 0, 0, 255);
-    render_arrow(renderer, _position, _position + _speed, 255, 0, 0, 255);
-    render_arrow(renderer, _position, _position + _accel, 0, 255, 0, 255);
-    SDL_Rect rb;
-    rough_bbox(rb);
-    render_rect(renderer, rb, 200, 0, 0, 255);
-    render_polygon(renderer, get_tight_bbox(), 0, 255, 0, 255);
-    if (_collision_pt.x > 0)
-      render_point(renderer, _collision_pt, 5, 255, 255, 0);
-#endif
-    return ok;
-  }
-
-  inline Point2d offset2world_pos(const Point2d & p) const {
-    return _position + rotate(_rendering_scale * (p - _tex_ptr->center()), _angle);
-  }
-  inline Point2d world_pos2offset(const Point2d & p) const {
-    return _tex_ptr->center() + rotate(p - _position, -_angle);
-  }
-
-  inline void rough_bbox(SDL_Rect & bbox) const {
-    bbox.x = _position.x - _entity_radius;
-    bbox.y = _position.y - _entity_radius;
-    bbox.w = 2 * _entity_radius;
-    bbox.h = 2 * _entity_radius;
-  }
-  inline void compute_tight_bbox_if_needed() {
-    if (!_compute_tight_bbox_needed)
-      return;
-    _compute_tight_bbox_needed = false;
-    _tight_bbox.resize(4);
-    for (unsigned int i = 0; i < _bbox_offset.size(); ++i)
-      _tight_bbox[i] = offset2world_pos(_bbox_offset[i]);
-  }
-
-  inline bool collides_with(Entity & other,
-                            int minalpha = 1) {
-    // rough radius check
-    if ((_position-other._position).norm() > _entity_radius + other._entity_radius)
-      return false;
-    // tight bbox check
-    if (!IsPolygonsIntersecting(get_tight_bbox(), other.get_tight_bbox()))
-      return false;
-    // http://www.sdltutorials.com/sdl-per-pixel-collision
-    // compute rectangle intersection between both rough bboxes
-    SDL_Rect aB, bB, inter;
-    rough_bbox(aB);
-    other.rough_bbox(bB);
-    SDL_IntersectRect(&aB, &bB, &inter);
-    // for each point of the intersect, check if it can be a collision pt
-    std::vector<Point2d> aT = get_tight_bbox(), bT = get_tight_bbox();
-    for (int x = 0; x < inter.w; ++x) {
-      _collision_pt.x = inter.x + x;
-      for (int y = 0; y < inter.h; ++y) {
-        _collision_pt.y = inter.y + y;
-        // first check the test pt belongs to the tight bbox
-        if (!point_inside_polygon(_collision_pt, aT)
-            || !point_inside_polygon(_collision_pt, bT))
-          continue;
-        // transform test point in picture frame
-        Point2d PA = world_pos2offset(_collision_pt);
-        // check alpha
-        if (_tex_ptr->get_alpha(PA) < minalpha)
-          continue;
-        Point2d PB = other.world_pos2offset(_collision_pt);
-        if (other._tex_ptr->get_alpha(PB) < minalpha)
-          continue;
-        // matching pixel found
-        return true;
-      } // end loop y
-    } // end loop x
-    _collision_pt = Point2d(-1, -1);
-    return false; // no matching pixel found
-  }
-
-protected:
-  void update_children_positions() {
-    for (unsigned int i = 0; i < _children.size(); ++i)
-      _children[i].second.set_position( offset2world_pos( _children[i].first ) );
-  }
-
-  Timer _life_timer, _update_timer;
-  Point2d _position, _accel, _speed;
-  double _angle, _angspeed;
-  double _tex_radius, _entity_radius, _rendering_scale;
-  bool _compute_tight_bbox_needed;
-  inline std::vector<Point2d> & get_tight_bbox() {
-    compute_tight_bbox_if_needed();
-    return _tight_bbox;
-  }
-  Texture* _tex_ptr;
-  Point2d _collision_pt;
-  std::vector<Point2d> _bbox_offset, _tight_bbox;
-  std::vector< std::pair<Point2d, Entity> > _children;
-}; // end class Entity
-
 #endif // SDL_UTILS_H
 
@@ -0,0 +1,150 @@
+/*!
+  \file        spatial_grid.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+A uniform grid broadphase for the collisions of the cars with the candies,
+the only entities that collide: objects are stored as circles in the cells they overlap,
+so that a query only visits the objects near it, instead of all of them.
+The grid is rebuilt at each frame in a FrameArena: nothing is allocated
+on the heap once the arena is large enough.
+ */
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+#include "frame_arena.h"
+
+class SpatialGrid {
+public:
+  SpatialGrid() : _ncols(0), _nrows(0), _cell_size(1), _arena(NULL),
+    _heads(NULL), _circles(NULL), _stamps(NULL), _nobjects(0), _query_stamp(0) {}
+
+  /*! set the size of the world and of the cells.
+   * Objects out of the world are stored in the border cells.
+   * The cell size should be close to the diameter of the common objects.
+   */
+  void resize(int worldw, int worldh, double cell_size) {
+    _cell_size = cell_size;
+    _ncols = std::max(1, (int) ceil(worldw / cell_size));
+    _nrows = std::max(1, (int) ceil(worldh / cell_size));
+    _arena = NULL;
+    _nobjects = 0;
+  }
+
+  /*! remove all objects, and get ready for up to \arg nobjects ones,
+   * stored in \arg arena: the grid is valid until the next reset() of the arena.
+   */
+  void clear(FrameArena & arena, unsigned int nobjects) {
+    _arena = &arena;
+    _nobjects = nobjects;
+    _heads = arena.alloc_zeroed<Entry*>(_ncols * _nrows);
+    _circles = arena.alloc<Circle>(nobjects);
+    std::fill(_circles, _circles + nobjects, Circle());
+    _stamps = arena.alloc_zeroed<unsigned int>(nobjects);
+    _query_stamp = 0;
+  }
+
+  /*! add an object.
+   * \param id the index of the object in the caller container:
+   *    ids must be dense, i.e. in [0, nobjects) of clear()
+   */
+  void insert(unsigned int id, double x, double y, double radius) {
+    if (id >= _nobjects) {
+      printf("SpatialGrid: id %i out of [0, %i)\n", id, _nobjects);
+      return;
+    }
+    _circles[id] = Circle(x, y, radius);
+    int c0, r0, c1, r1;
+    cell_range(x, y, radius, c0, r0, c1, r1);
+    for (int r = r0; r <= r1; ++r) {
+      for (int c = c0; c <= c1; ++c) {
+        Entry* & head = _heads[r * _ncols + c];
+        Entry* e = _arena->alloc<Entry>(1);
+        e->id = id;
+        e->next = head;
+        head = e;
+      } // end loop c
+    } // end loop r
+  }
+
+  /*! find the objects whose circle overlaps a given circle.
+   * \param out the ids of the objects, each one once, in increasing order
+   */
+  void query(double x, double y, double radius, std::vector<unsigned int> & out) {
+    out.clear();
+    if (_heads == NULL)
+      return;
+    ++_query_stamp;
+    int c0, r0, c1, r1;
+    cell_range(x, y, radius, c0, r0, c1, r1);
+    for (int r = r0; r <= r1; ++r) {
+      for (int c = c0; c <= c1; ++c) {
+        for (const Entry* e = _heads[r * _ncols + c]; e != NULL; e = e->next) {
+          unsigned int id = e->id;
+          if (_stamps[id] == _query_stamp)
+            continue; // already seen in another cell
+          _stamps[id] = _query_stamp;
+          if (_circles[id].overlaps(x, y, radius))
+            out.push_back(id);
+        } // end loop e
+      } // end loop c
+    } // end loop r
+    std::sort(out.begin(), out.end());
+  }
+
+private:
+  struct Circle {
+    Circle(double x_ = 0, double y_ = 0, double radius_ = -1) : x(x_), y(y_), radius(radius_) {}
+    inline bool overlaps(double ox, double oy, double oradius) const {
+      double dx = x - ox, dy = y - oy, r = radius + oradius;
+      return (radius >= 0 && dx * dx + dy * dy <= r * r);
+    }
+    double x, y, radius;
+  };
+  //! an object in the list of a cell
+  struct Entry {
+    unsigned int id;
+    Entry* next;
+  };
+
+  inline int clamp_col(double x) const {
+    return std::min(std::max((int) floor(x / _cell_size), 0), _ncols - 1);
+  }
+  inline int clamp_row(double y) const {
+    return std::min(std::max((int) floor(y / _cell_size), 0), _nrows - 1);
+  }
+  inline void cell_range(double x, double y, double radius,
+                         int & c0, int & r0, int & c1, int & r1) const {
+    c0 = clamp_col(x - radius);
+    c1 = clamp_col(x + radius);
+    r0 = clamp_row(y - radius);
+    r1 = clamp_row(y + radius);
+  }
+  int _ncols, _nrows;
+  double _cell_size;
+  // in the arena of the frame
+  FrameArena* _arena;
+  Entry** _heads; //!< the list of each cell
+  Circle* _circles;
+  unsigned int* _stamps; //!< the last query that saw each object
+  unsigned int _nobjects, _query_stamp;
+}; // end class SpatialGrid
+
+#endif // SPATIAL_GRID_H
@@ -0,0 +1,155 @@
+/*!
+  \file        sprite_batch.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+Batched rendering of sprites: one draw call per texture instead of per sprite.
+ */
+#ifndef SPRITE_BATCH_H
+#define SPRITE_BATCH_H
+
+#include "sdl_utils.h"
+
+#define SPRITE_BATCH_GEOMETRY SDL_VERSION_ATLEAST(2, 0, 18)
+
+//! the color of the sprites drawn as they are
+static const SDL_Color SPRITE_WHITE = {255, 255, 255, 255};
+
+/*! Collect rotated and scaled sprites, then draw them with flush():
+  the quads of each texture are gathered in one vertex array and drawn
+  with a single SDL_RenderGeometry() call.
+  Sprites of the same texture keep their order, but sprites of different
+  textures may be reordered: flush between layers that must not mix.
+  The arrays are kept between flushes, so that a steady frame does not allocate.
+  With SDL < 2.0.18, the sprites are drawn one by one.
+*/
+class SpriteBatch {
+public:
+  SpriteBatch() : _nbuckets(0), _ndraw_calls(0), _nsprites(0) {}
+
+  //! add a sprite centered on \arg p, as Texture::render_center() would draw it
+  //! \arg color multiplies the colors of the texture, e.g. to tint white glyphs
+  void add(const Texture & tex, const Point2d & p, double scale = 1, double angle_rad = 0,
+           const SDL_Color & color = SPRITE_WHITE) {
+    if (tex.get_sdl_texture() == NULL)
+      return;
+    Sprite s;
+    s.tex = &tex;
+    s.p = p;
+    s.scale = scale;
+    s.angle_rad = angle_rad;
+    s.color = color;
+    _sprites.push_back(s);
+  }
+
+  //! draw all the sprites added since the last flush
+  bool flush(SDL_Renderer* renderer) {
+    bool ok = true;
+    _nsprites += _sprites.size();
+#if SPRITE_BATCH_GEOMETRY
+    // gather the quads per texture
+    for (unsigned int b = 0; b < _nbuckets; ++b) {
+      _buckets[b].vertices.clear();
+      _buckets[b].indices.clear();
+    }
+    _nbuckets = 0;
+    for (unsigned int i = 0; i < _sprites.size(); ++i)
+      add_quad(bucket(_sprites[i].tex->get_sdl_texture()), _sprites[i]);
+    // one draw call per texture
+    for (unsigned int b = 0; b < _nbuckets; ++b) {
+      Bucket* bk = &(_buckets[b]);
+      ++_ndraw_calls;
+      if (SDL_RenderGeometry(renderer, bk->sdltex, &(bk->vertices[0]), bk->vertices.size(),
+                             &(bk->indices[0]), bk->indices.size()) == 0)
+        continue;
+      printf("SDL_RenderGeometry() returned an error '%s'!\n", SDL_GetError());
+      ok = false;
+    } // end loop b
+#else // no SDL_RenderGeometry(): one draw call per sprite
+    for (unsigned int i = 0; i < _sprites.size(); ++i) {
+      const Sprite & s = _sprites[i];
+      ++_ndraw_calls;
+      SDL_SetTextureColorMod(s.tex->get_sdl_texture(), s.color.r, s.color.g, s.color.b);
+      ok = s.tex->render_center(renderer, s.p, s.scale, NULL, s.angle_rad) && ok;
+      SDL_SetTextureColorMod(s.tex->get_sdl_texture(), 255, 255, 255);
+    }
+#endif // SPRITE_BATCH_GEOMETRY
+    _sprites.clear();
+    return ok;
+  }
+
+  //! the number of draw calls and of sprites since the last reset_stats()
+  inline unsigned int get_draw_calls() const { return _ndraw_calls; }
+  inline unsigned int get_sprites() const { return _nsprites; }
+  inline void reset_stats() { _ndraw_calls = _nsprites = 0; }
+
+private:
+  struct Sprite {
+    const Texture* tex;
+    Point2d p;
+    double scale, angle_rad;
+    SDL_Color color;
+  };
+
+#if SPRITE_BATCH_GEOMETRY
+  struct Bucket {
+    SDL_Texture* sdltex;
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+  };
+
+  //! the bucket of a texture, created if needed. There are few textures per flush.
+  Bucket* bucket(SDL_Texture* sdltex) {
+    for (unsigned int b = 0; b < _nbuckets; ++b) {
+      if (_buckets[b].sdltex == sdltex)
+        return &(_buckets[b]);
+    }
+    if (_nbuckets >= _buckets.size())
+      _buckets.resize(_nbuckets + 1);
+    _buckets[_nbuckets].sdltex = sdltex;
+    return &(_buckets[_nbuckets++]);
+  }
+
+  //! the 4 corners of the sprite, rotated around its center
+  static void add_quad(Bucket* bk, const Sprite & s) {
+    double hw = .5 * s.scale * s.tex->get_width(), hh = .5 * s.scale * s.tex->get_height(),
+        cosa = cos(s.angle_rad), sina = sin(s.angle_rad);
+    static const double cx[4] = {-1, 1, 1, -1}, cy[4] = {-1, -1, 1, 1};
+    float tu[2], tv[2]; // the sub-rectangle of the picture, in an atlas
+    s.tex->get_uv(tu[0], tv[0], tu[1], tv[1]);
+    int first = bk->vertices.size();
+    for (unsigned int c = 0; c < 4; ++c) {
+      SDL_Vertex v;
+      v.position.x = s.p.x + ROTATE_COSSIN_X(cx[c] * hw, cy[c] * hh, cosa, sina);
+      v.position.y = s.p.y + ROTATE_COSSIN_Y(cx[c] * hw, cy[c] * hh, cosa, sina);
+      v.color = s.color;
+      v.tex_coord.x = tu[cx[c] > 0];
+      v.tex_coord.y = tv[cy[c] > 0];
+      bk->vertices.push_back(v);
+    }
+    static const int quad[6] = {0, 1, 2, 0, 2, 3};
+    for (unsigned int i = 0; i < 6; ++i)
+      bk->indices.push_back(first + quad[i]);
+  }
+
+  std::vector<Bucket> _buckets;
+#endif // SPRITE_BATCH_GEOMETRY
+  unsigned int _nbuckets;
+  std::vector<Sprite> _sprites;
+  unsigned int _ndraw_calls, _nsprites;
+}; // end class SpriteBatch
+
+#endif // SPRITE_BATCH_H
@@ -0,0 +1,237 @@
+/*!
+  \file        texture_atlas.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+Packing of many small textures into a few big ones, the atlas pages,
+so that sprites of different pictures can be drawn in the same draw call.
+ */
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include "sdl_utils.h"
+
+/*! Collect textures with add(), then pack them with build().
+  The pictures are placed with a skyline bottom-left packer,
+  from the tallest to the shortest, with a padding of one pixel
+  to avoid bleeding between neighbours when filtering.
+  Each texture then becomes a view on a sub-rectangle of a page:
+  its own SDL_Texture, if any, is destroyed, while its surface and mask are kept.
+  The textures can thus be only decoded, see Texture::decode_file().
+  The pages belong to the atlas and are destroyed with it,
+  so the atlas must live longer than the textures it contains.
+*/
+class TextureAtlas {
+public:
+  TextureAtlas() {}
+  ~TextureAtlas() { free(); }
+
+  void free() {
+    for (unsigned int i = 0; i < _pages.size(); ++i)
+      SDL_DestroyTexture(_pages[i]);
+    _pages.clear();
+    _textures.clear();
+  }
+
+  //! textures without surface (e.g. rendered text) are ignored
+  void add(Texture* tex) {
+    if (tex->get_sdl_surface() != NULL && !tex->in_atlas())
+      _textures.push_back(tex);
+  }
+
+  /*! pack all the added textures into pages of page_size x page_size pixels.
+   * Textures bigger than a page keep their own SDL_Texture.
+   * Textures with premultiplied colors and with straight ones
+   * are packed in different pages, as they are blended differently.
+   * \return false if a page could not be created
+   */
+  bool build(SDL_Renderer* renderer, int page_size = 2048) {
+    TraceScope trace("TextureAtlas::build");
+    return build(renderer, page_size, false) && build(renderer, page_size, true);
+  }
+
+  inline unsigned int get_npages() const { return _pages.size(); }
+
+private:
+  static const int PADDING = 1;
+
+  //! pack the textures whose colors are premultiplied, or not
+  bool build(SDL_Renderer* renderer, int page_size, bool premultiplied) {
+    std::vector<Texture*> todo;
+    for (unsigned int i = 0; i < _textures.size(); ++i) {
+      if (_textures[i]->in_atlas() || _textures[i]->is_premultiplied() != premultiplied)
+        continue;
+      if (_textures[i]->get_width() + 2 * PADDING > page_size
+          || _textures[i]->get_height() + 2 * PADDING > page_size) {
+        if (!_textures[i]->upload(renderer)) // too big, stays standalone
+          return false;
+        continue;
+      }
+      todo.push_back(_textures[i]);
+    }
+    std::stable_sort(todo.begin(), todo.end(), taller);
+    while (!todo.empty()) {
+      std::vector<Texture*> placed, left;
+      std::vector<SDL_Rect> rects;
+      Skyline sky(page_size);
+      for (unsigned int i = 0; i < todo.size(); ++i) {
+        SDL_Rect r;
+        r.w = todo[i]->get_width();
+        r.h = todo[i]->get_height();
+        if (!sky.insert(r.w + 2 * PADDING, r.h + 2 * PADDING, r.x, r.y)) {
+          left.push_back(todo[i]);
+          continue;
+        }
+        r.x += PADDING;
+        r.y += PADDING;
+        placed.push_back(todo[i]);
+        rects.push_back(r);
+      } // end loop i
+      if (!make_page(renderer, page_size, sky.height(), premultiplied, placed, rects))
+        return false;
+      todo = left;
+    } // end while (!todo.empty())
+    return true;
+  } // end build()
+
+  static bool taller(const Texture* a, const Texture* b) {
+    if (a->get_height() != b->get_height())
+      return a->get_height() > b->get_height();
+    return a->get_width() > b->get_width();
+  }
+
+  //! the top outline of the placed rectangles, as horizontal segments
+  class Skyline {
+  public:
+    Skyline(int size) : _size(size), _height(0) {
+      _segments.push_back(Segment(0, 0, size));
+    }
+    //! find the lowest, then leftmost, position for a rectangle w x h
+    bool insert(int w, int h, int & x, int & y) {
+      int best = -1, besty = _size;
+      for (unsigned int i = 0; i < _segments.size(); ++i) {
+        int sy;
+        if (!fits(i, w, h, sy) || sy >= besty)
+          continue;
+        best = i;
+        besty = sy;
+      } // end loop i
+      if (best < 0)
+        return false;
+      x = _segments[best].x;
+      y = besty;
+      // the new segment replaces the ones below it
+      _segments.insert(_segments.begin() + best, Segment(x, y + h, w));
+      for (unsigned int i = best + 1; i < _segments.size(); ++i) {
+        Segment & s = _segments[i];
+        int shrink = x + w - s.x;
+        if (shrink <= 0)
+          break;
+        if (shrink < s.w) {
+          s.x += shrink;
+          s.w -= shrink;
+          break;
+        }
+        _segments.erase(_segments.begin() + i);
+        --i;
+      } // end loop i
+      // merge the neighbours at the same height
+      for (unsigned int i = 0; i + 1 < _segments.size(); ++i) {
+        if (_segments[i].y != _segments[i + 1].y)
+          continue;
+        _segments[i].w += _segments[i + 1].w;
+        _segments.erase(_segments.begin() + i + 1);
+        --i;
+      } // end loop i
+      _height = std::max(_height, y + h);
+      return true;
+    } // end insert()
+    inline int height() const { return _height; }
+
+  private:
+    struct Segment {
+      Segment(int x_, int y_, int w_) : x(x_), y(y_), w(w_) {}
+      int x, y, w;
+    };
+    //! can a rectangle w x h lie on the skyline starting at segment i?
+    bool fits(unsigned int i, int w, int h, int & y) const {
+      if (_segments[i].x + w > _size)
+        return false;
+      y = 0;
+      int wleft = w;
+      while (wleft > 0) {
+        y = std::max(y, _segments[i].y);
+        if (y + h > _size)
+          return false;
+        wleft -= _segments[i].w;
+        ++i;
+      }
+      return true;
+    }
+    int _size, _height;
+    std::vector<Segment> _segments;
+  }; // end class Skyline
+
+  //! blit the pictures in a page and make the textures views on it
+  bool make_page(SDL_Renderer* renderer, int pagew, int pageh, bool premultiplied,
+                 std::vector<Texture*> & textures, std::vector<SDL_Rect> & rects) {
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat
+        (0, pagew, pageh, 32, SDL_PIXELFORMAT_RGBA32);
+    if (surface == NULL) {
+      printf("Unable to create atlas page %ix%i! SDL Error: %s\n",
+             pagew, pageh, SDL_GetError());
+      return false;
+    }
+    SDL_FillRect(surface, NULL, SDL_MapRGBA(surface->format, 0, 0, 0, 0));
+    for (unsigned int i = 0; i < textures.size(); ++i) {
+      SDL_Surface* src = textures[i]->get_sdl_surface();
+      // copy the alpha channel as is, without blending with the empty page
+      SDL_BlendMode mode;
+      SDL_GetSurfaceBlendMode(src, &mode);
+      SDL_SetSurfaceBlendMode(src, SDL_BLENDMODE_NONE);
+      SDL_BlitSurface(src, NULL, surface, &rects[i]);
+      SDL_SetSurfaceBlendMode(src, mode);
+    } // end loop i
+    SDL_Texture* page = SDL_CreateTextureFromSurface(renderer, surface);
+    if (page != NULL && !set_blend_mode(page, premultiplied)) {
+      // the renderer does not know premultiplied colors: go back to straight ones,
+      // as Texture::upload() does
+      SDL_DestroyTexture(page);
+      unpremultiply_surface(surface);
+      page = SDL_CreateTextureFromSurface(renderer, surface);
+      if (page != NULL)
+        set_blend_mode(page, false);
+    }
+    SDL_FreeSurface(surface);
+    if (page == NULL) {
+      printf("Unable to create atlas page texture! SDL Error: %s\n", SDL_GetError());
+      return false;
+    }
+    _pages.push_back(page);
+    for (unsigned int i = 0; i < textures.size(); ++i) {
+      textures[i]->set_atlas_view(page, pagew, pageh, rects[i]);
+      textures[i]->release_surface(); // according to its mode
+    }
+    DEBUG_PRINT("TextureAtlas: page %ix%i with %i textures\n",
+                pagew, pageh, (int) textures.size());
+    return true;
+  } // end make_page()
+
+  std::vector<Texture*> _textures;
+  std::vector<SDL_Texture*> _pages;
+}; // end class TextureAtlas
+
+#endif // TEXTURE_ATLAS_H
@@ -0,0 +1,124 @@
+/*!
+  \file        thread_pool.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+A fixed pool of worker threads running jobs from a shared queue.
+ */
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <SDL2/SDL.h>
+#include <deque>
+#include <vector>
+
+//! a piece of work for the pool
+class Job {
+public:
+  virtual ~Job() {}
+  virtual void run() = 0;
+}; // end class Job
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*! The jobs are run in the order they are pushed, by the first idle worker.
+  Jobs can push other jobs while they run.
+  The pool does not own the jobs: they must live until wait() returns.
+*/
+class ThreadPool {
+public:
+  //! \arg nthreads the number of workers, by default one per core
+  ThreadPool(int nthreads = -1) : _npending(0), _stop(false) {
+    if (nthreads <= 0)
+      nthreads = SDL_GetCPUCount();
+    _mutex = SDL_CreateMutex();
+    _job_cond = SDL_CreateCond();
+    _idle_cond = SDL_CreateCond();
+    for (int i = 0; i < nthreads; ++i) {
+      SDL_Thread* thread = SDL_CreateThread(worker, "ThreadPool", this);
+      if (thread == NULL) {
+        printf("ThreadPool: could not create thread: '%s'\n", SDL_GetError());
+        break;
+      }
+      _threads.push_back(thread);
+    } // end loop i
+  }
+
+  ~ThreadPool() {
+    SDL_LockMutex(_mutex);
+    _stop = true;
+    SDL_CondBroadcast(_job_cond);
+    SDL_UnlockMutex(_mutex);
+    for (unsigned int i = 0; i < _threads.size(); ++i)
+      SDL_WaitThread(_threads[i], NULL);
+    SDL_DestroyCond(_idle_cond);
+    SDL_DestroyCond(_job_cond);
+    SDL_DestroyMutex(_mutex);
+  }
+
+  //! if the pool has no thread, the job is run right away
+  void push(Job* job) {
+    if (_threads.empty()) {
+      job->run();
+      return;
+    }
+    SDL_LockMutex(_mutex);
+    _jobs.push_back(job);
+    ++_npending;
+    SDL_CondSignal(_job_cond);
+    SDL_UnlockMutex(_mutex);
+  }
+
+  //! block until all the pushed jobs are finished
+  void wait() {
+    SDL_LockMutex(_mutex);
+    while (_npending > 0)
+      SDL_CondWait(_idle_cond, _mutex);
+    SDL_UnlockMutex(_mutex);
+  }
+
+  inline unsigned int get_nthreads() const { return _threads.size(); }
+
+private:
+  static int worker(void* data) {
+    ThreadPool* pool = (ThreadPool*) data;
+    SDL_LockMutex(pool->_mutex);
+    while (true) {
+      while (pool->_jobs.empty() && !pool->_stop)
+        SDL_CondWait(pool->_job_cond, pool->_mutex);
+      if (pool->_jobs.empty()) // stopping
+        break;
+      Job* job = pool->_jobs.front();
+      pool->_jobs.pop_front();
+      SDL_UnlockMutex(pool->_mutex);
+      job->run();
+      SDL_LockMutex(pool->_mutex);
+      if (--pool->_npending == 0)
+        SDL_CondBroadcast(pool->_idle_cond);
+    } // end while (true)
+    SDL_UnlockMutex(pool->_mutex);
+    return 0;
+  }
+
+  SDL_mutex* _mutex;
+  SDL_cond *_job_cond, *_idle_cond;
+  std::vector<SDL_Thread*> _threads;
+  std::deque<Job*> _jobs;
+  unsigned int _npending;
+  bool _stop;
+}; // end class ThreadPool
+
+#endif // THREAD_POOL_H
@@ -25,52 +25,197 @@ ________________________________________________________________________________
 
 // c includes
 #include <stdio.h>
-#include <sys/time.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+//! the time on the monotonic clock, that never jumps (seconds)
+inline double monotonic_seconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1E9;
+}
+
 class Timer {
 public:
   typedef double Time;
   static const Time NOTIME = -1;
   Timer() { reset(); }
   virtual inline void reset() {
-    gettimeofday(&start, NULL);
+    start = monotonic_seconds();
   }
-  //! get the time since ctor or last reset (milliseconds)
+  //! get the time since ctor or last reset (seconds)
   virtual inline Time getTimeSeconds() const {
-    struct timeval end;
-    gettimeofday(&end, NULL);
-    return (Time) (// seconds
-                   (end.tv_sec - start.tv_sec)
-                   +
-                   // useconds
-                   (end.tv_usec - start.tv_usec)
-                   / 1E6);
+    return monotonic_seconds() - start;
   }
 private:
-  struct timeval start;
+  Time start;
 }; // end class Timer
 
 ////////////////////////////////////////////////////////////////////////////////
 
-class Rate {
+/*! a deterministic simulation clock, advanced by fixed ticks.
+  The time is computed from the number of ticks,
+  so that two runs with the same inputs give the same results.
+*/
+class SimClock {
+public:
+  SimClock(double rate_hz = 20) : _tick_sec(1. / rate_hz), _ticks(0) {}
+  inline void tick()                  { ++_ticks; }
+  //! the duration of one tick (seconds)
+  inline double dt() const            { return _tick_sec; }
+  //! the time since the start of the simulation (seconds)
+  inline double now() const           { return _ticks * _tick_sec; }
+  inline unsigned long ticks() const  { return _ticks; }
+
+private:
+  double _tick_sec;
+  unsigned long _ticks;
+}; // end class SimClock
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*! A histogram of durations with fixed bins, that never allocates after
+  construction: percentiles are exact up to the bin width.
+  Durations beyond the last bin are counted in it, the maximum is exact.
+*/
+class TimeHistogram {
+public:
+  //! \arg bin_ms the width of a bin, \arg max_ms the range of the histogram (milliseconds)
+  TimeHistogram(double bin_ms = .01, double max_ms = 100)
+    : _bin_ms(bin_ms), _nbins(1 + max_ms / bin_ms), _bins(new unsigned int[_nbins]) {
+    clear();
+  }
+  ~TimeHistogram() { delete[] _bins; }
+
+  void clear() {
+    memset(_bins, 0, _nbins * sizeof(unsigned int));
+    _count = 0;
+    _max_ms = 0;
+  }
+
+  inline void add(double ms) {
+    unsigned int bin = (ms <= 0 ? 0 : ms / _bin_ms);
+    ++_bins[bin < _nbins ? bin : _nbins - 1];
+    ++_count;
+    if (_max_ms < ms)
+      _max_ms = ms;
+  }
+
+  //! \return the upper bound of the bin holding the \arg p quantile, p in [0, 1]
+  double percentile(double p) const {
+    if (_count == 0)
+      return 0;
+    unsigned long rank = p * (_count - 1), seen = 0;
+    for (unsigned int bin = 0; bin < _nbins; ++bin) {
+      seen += _bins[bin];
+      if (seen > rank)
+        return (bin + 1 == _nbins ? _max_ms : (bin + 1) * _bin_ms);
+    }
+    return _max_ms;
+  }
+
+  inline unsigned long count() const { return _count; }
+  inline double max() const { return _max_ms; }
+
+  //! one line with p50, p99 and max
+  void print(const char* name) const {
+    printf("  %-20s p50 %7.3f ms   p99 %7.3f ms   max %7.3f ms\n",
+           name, percentile(.5), percentile(.99), _max_ms);
+  }
+
+private:
+  TimeHistogram(const TimeHistogram &); // not copyable
+  TimeHistogram & operator = (const TimeHistogram &);
+
+  double _bin_ms;
+  unsigned int _nbins;
+  unsigned int* _bins;
+  unsigned long _count;
+  double _max_ms;
+}; // end class TimeHistogram
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! the end of the wait of FramePacer that is spun
+static const double FRAME_PACER_SPIN_SEC = 1.5E-3;
+
+/*! Schedules the frames of a fixed-rate loop on the monotonic clock.
+  The deadlines are absolute: deadline(n+1) = deadline(n) + period,
+  so that oversleeping one frame does not delay the next ones.
+  wait() sleeps until shortly before the deadline, then spins until it,
+  as the sleep of the kernel can overshoot by a fraction of a millisecond.
+  With vsync, SDL_RenderPresent() already waits for the vertical blank:
+  wait() then only measures the frames, a frame longer than 1.5 periods
+  missed a vertical blank.
+
+  When the loop misses a deadline, wait() returns at once, with the number
+  of ticks due: the caller runs as many updates to catch up.
+  After more than MAX_CATCHUP_TICKS, e.g. when the window was dragged,
+  the late ticks are dropped and the deadlines restart from now.
+*/
+class FramePacer {
 public:
-  Rate(double rate_hz) : _rate_hz(rate_hz) {
-    _period_sec = 1. / _rate_hz;
+  static const unsigned int MAX_CATCHUP_TICKS = 5;
+
+  FramePacer(double rate_hz, bool vsync = false)
+    : _period_sec(1. / rate_hz), _vsync(vsync), _nmissed(0), _ndropped(0) {
+    _deadline = _last_frame = monotonic_seconds();
+  }
+
+  //! wait for the next deadline.
+  //! \return the number of simulation ticks due, >= 1
+  unsigned int wait() {
+    _deadline += _period_sec;
+    double now = monotonic_seconds();
+    unsigned int nticks = 1;
+    if (_vsync) { // the vertical blank gave the edge of the frame
+      if (now - _last_frame > 1.5 * _period_sec)
+        ++_nmissed;
+      _deadline = now;
+    }
+    else if (now > _deadline) { // late
+      unsigned int nlate = (now - _deadline) / _period_sec;
+      ++_nmissed;
+      if (nlate < MAX_CATCHUP_TICKS) {
+        nticks += nlate;
+        _deadline += nlate * _period_sec;
+      }
+      else { // too late, give up on the lost ticks
+        nticks = MAX_CATCHUP_TICKS;
+        _ndropped += nlate + 1 - MAX_CATCHUP_TICKS;
+        _deadline = now;
+      }
+    }
+    else {
+      double time_left = _deadline - now - FRAME_PACER_SPIN_SEC;
+      if (time_left > 0)
+        usleep(1E6 * time_left);
+      while (monotonic_seconds() < _deadline) {} // spin
+      now = monotonic_seconds();
+    }
+    double frame_ms = 1000 * (now - _last_frame), period_ms = 1000 * _period_sec;
+    _frame_times.add(frame_ms);
+    _jitters.add(frame_ms > period_ms ? frame_ms - period_ms : period_ms - frame_ms);
+    _last_frame = now;
+    return nticks;
   }
 
-  double sleep() {
-    double time_left = _period_sec - _timer.getTimeSeconds();
-    if (time_left > 1E-3) // 1 ms
-      usleep(1E6 * time_left);
-    _timer.reset();
-    return time_left;
+  void print_stats(const char* name = "Frame pacing") const {
+    printf("%s: %lu frames at %g Hz%s, %lu missed deadlines, %lu ticks dropped\n",
+           name, _frame_times.count(), 1. / _period_sec, (_vsync ? " (vsync)" : ""),
+           _nmissed, _ndropped);
+    _frame_times.print("frame time");
+    _jitters.print("jitter");
   }
 
 private:
-  Timer _timer;
-  double _rate_hz, _period_sec;
-}; // end class Rate
+  double _period_sec;
+  bool _vsync;
+  double _deadline, _last_frame; // monotonic_seconds()
+  unsigned long _nmissed, _ndropped;
+  TimeHistogram _frame_times, _jitters;
+}; // end class FramePacer
 
 #endif /*TIMER_H_*/
 
@@ -0,0 +1,197 @@
+/*!
+  \file        trace.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+Recording of timed spans, written in the Chrome Trace Event format:
+the file opens in chrome://tracing or in https://ui.perfetto.dev
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <SDL2/SDL.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "timer.h"
+
+//! a span of the trace, with an optional integer argument
+struct TraceEvent {
+  static const unsigned int NAME_SIZE = 64;
+  char name[NAME_SIZE];
+  const char* arg_name; //!< static string, NULL if no argument
+  long arg;
+  double start_us, duration_us;
+};
+
+//! the events of one thread, only written by this thread
+struct TraceBuffer {
+  std::string thread_name;
+  std::vector<TraceEvent> events;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*! Each thread records its events in its own TraceBuffer, found through
+  a thread-local pointer: recording takes no lock.
+  The mutex only protects the list of buffers, when a thread records
+  its first event, and when the trace is written.
+  Nothing is recorded until start() is called.
+*/
+class Tracer {
+public:
+  Tracer() : _enabled(false), _origin(0), _main_thread(0) { _mutex = SDL_CreateMutex(); }
+  ~Tracer() {
+    for (unsigned int i = 0; i < _buffers.size(); ++i)
+      delete _buffers[i];
+    SDL_DestroyMutex(_mutex);
+  }
+
+  //! the tracer of the program
+  static Tracer & instance() {
+    static Tracer tracer;
+    return tracer;
+  }
+
+  //! to be called by the main thread
+  void start() {
+    _main_thread = SDL_ThreadID();
+    _origin = monotonic_seconds();
+    _enabled = true;
+  }
+  inline bool enabled() const { return _enabled; }
+
+  //! the time since start() (microseconds)
+  inline double now_us() const { return 1E6 * (monotonic_seconds() - _origin); }
+
+  //! \arg name is copied: for long names, e.g. paths, only the end is kept
+  void record(const char* name, double start_us, double duration_us,
+              const char* arg_name = NULL, long arg = 0) {
+    TraceEvent e;
+    size_t len = strlen(name);
+    if (len >= TraceEvent::NAME_SIZE)
+      name += len - (TraceEvent::NAME_SIZE - 1);
+    strncpy(e.name, name, TraceEvent::NAME_SIZE - 1);
+    e.name[TraceEvent::NAME_SIZE - 1] = 0;
+    e.arg_name = arg_name;
+    e.arg = arg;
+    e.start_us = start_us;
+    e.duration_us = duration_us;
+    thread_buffer().events.push_back(e);
+  }
+
+  //! write all the events in \arg filename, in the Chrome Trace Event format
+  bool write(const std::string & filename) {
+    FILE* file = fopen(filename.c_str(), "w");
+    if (file == NULL) {
+      printf("Tracer: could not open '%s'\n", filename.c_str());
+      return false;
+    }
+    unsigned int nevents = 0;
+    SDL_LockMutex(_mutex);
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (unsigned int tid = 0; tid < _buffers.size(); ++tid) {
+      const TraceBuffer & buffer = *_buffers[tid];
+      fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,"
+              "\"args\":{\"name\":\"%s\"}}",
+              (tid > 0 ? ",\n" : ""), tid, buffer.thread_name.c_str());
+      for (unsigned int i = 0; i < buffer.events.size(); ++i) {
+        const TraceEvent & e = buffer.events[i];
+        fprintf(file, ",\n{\"name\":\"");
+        write_escaped(file, e.name);
+        fprintf(file, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%i,\"ts\":%.3f,\"dur\":%.3f",
+                tid, e.start_us, e.duration_us);
+        if (e.arg_name != NULL)
+          fprintf(file, ",\"args\":{\"%s\":%li}", e.arg_name, e.arg);
+        fprintf(file, "}");
+      } // end loop i
+      nevents += buffer.events.size();
+    } // end loop tid
+    fprintf(file, "\n]}\n");
+    SDL_UnlockMutex(_mutex);
+    bool ok = (fclose(file) == 0);
+    printf("Wrote %i trace events of %i threads in '%s'\n",
+           nevents, (int) _buffers.size(), filename.c_str());
+    return ok;
+  }
+
+private:
+  //! the buffer of the calling thread, created at its first event
+  TraceBuffer & thread_buffer() {
+    static __thread TraceBuffer* buffer = NULL;
+    if (buffer != NULL)
+      return *buffer;
+    buffer = new TraceBuffer;
+    buffer->events.reserve(4096);
+    SDL_LockMutex(_mutex);
+    std::ostringstream name;
+    if (SDL_ThreadID() == _main_thread)
+      name << "main";
+    else
+      name << "worker " << _buffers.size();
+    buffer->thread_name = name.str();
+    _buffers.push_back(buffer);
+    SDL_UnlockMutex(_mutex);
+    return *buffer;
+  }
+
+  static void write_escaped(FILE* file, const char* text) {
+    for (const char* c = text; *c; ++c) {
+      if (*c == '"' || *c == '\\')
+        fputc('\\', file);
+      fputc(*c, file);
+    }
+  }
+
+  bool _enabled;
+  double _origin; // monotonic_seconds()
+  SDL_threadID _main_thread;
+  SDL_mutex* _mutex;
+  std::vector<TraceBuffer*> _buffers;
+}; // end class Tracer
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*! records a span from its creation to the end of its scope,
+  if the tracer is enabled. \arg name must live until then.
+*/
+class TraceScope {
+public:
+  TraceScope(const char* name) : _name(name), _arg_name(NULL), _arg(0) {
+    Tracer & tracer = Tracer::instance();
+    _start_us = (tracer.enabled() ? tracer.now_us() : -1);
+  }
+  ~TraceScope() {
+    if (_start_us < 0)
+      return;
+    Tracer & tracer = Tracer::instance();
+    tracer.record(_name, _start_us, tracer.now_us() - _start_us, _arg_name, _arg);
+  }
+
+  //! an integer shown with the span, \arg arg_name must be a static string
+  inline void set_arg(const char* arg_name, long arg) {
+    _arg_name = arg_name;
+    _arg = arg;
+  }
+
+private:
+  const char* _name;
+  const char* _arg_name;
+  long _arg;
+  double _start_us;
+}; // end class TraceScope
+
+#endif // TRACE_H
@@ -0,0 +1,219 @@
+/*!
+  \file        world_snapshot.h
+________________________________________________________________________________
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+________________________________________________________________________________
+
+What the renderer needs of the world after a tick of the simulation,
+and the buffers exchanging it between the simulation and rendering threads.
+ */
+#ifndef WORLD_SNAPSHOT_H
+#define WORLD_SNAPSHOT_H
+
+#include "entity.h"
+#include "sprite_batch.h"
+
+//! a sprite of a snapshot, as Texture::render_center() draws it
+struct SpriteState {
+  const Texture* tex;
+  Point2d position;
+  double angle, scale; // radians, rendering scale
+  unsigned int id; //!< the same for the same entity in two snapshots
+};
+
+#if DEBUG
+//! the overlay of an entity in DEBUG builds: its motion, its boxes and its last collision
+struct DebugState {
+  Point2d position, speed, accel;
+  SDL_Rect rough_bbox;
+  Point2d tight_bbox[4];
+  Point2d collision_pt; //!< x < 0 if none
+};
+#endif // DEBUG
+
+//! the score of a player, drawn in the HUD
+struct PlayerState {
+  const Texture* car;
+  int score, rank; // rank < 0 if none
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+//! an entity further than that between two snapshots jumped: it is not interpolated
+static const double SNAPSHOT_MAX_JUMP = 100; // pixels
+
+/*! The state of the world drawn in a frame: a layer of sprites per kind
+  of entity, in their drawing order, and the HUD.
+  It only points to the textures, that outlive the snapshots.
+  The vectors keep their memory when the snapshot is filled again.
+*/
+struct WorldSnapshot {
+  WorldSnapshot() : tick(0), publish_time(0), status(0), hud_time(-1) {}
+
+  void clear() {
+    candies.clear();
+    cars.clear();
+    fishes.clear();
+    bubbles.clear();
+    players.clear();
+#if DEBUG
+    debug.clear();
+#endif // DEBUG
+  }
+
+  //! add \arg e then its children, as SpriteBatch::add() does, with the same \arg id
+  static void add(std::vector<SpriteState> & layer, const Entity & e, unsigned int id) {
+    if (e.get_texture() == NULL)
+      return;
+    SpriteState s;
+    s.tex = e.get_texture();
+    s.position = e.get_position();
+    s.angle = e.get_angle();
+    s.scale = e.get_rendering_scale();
+    s.id = id;
+    layer.push_back(s);
+    for (unsigned int i = 0; i < e.get_nchildren(); ++i)
+      add(layer, e.get_child(i), id);
+  }
+
+  /*! the sprite \arg i of \arg layer, at \arg alpha in [0, 1] of the way
+   * from its state in \arg prev_layer, the same layer in the previous snapshot.
+   * Sprites that are new, whose texture changed or that jumped,
+   * e.g. a fish coming back on a border, are not interpolated.
+   */
+  static SpriteState interpolate(const std::vector<SpriteState> & prev_layer,
+                                 const std::vector<SpriteState> & layer,
+                                 unsigned int i, double alpha) {
+    const SpriteState & b = layer[i];
+    if (alpha >= 1 || i >= prev_layer.size())
+      return b;
+    const SpriteState & a = prev_layer[i];
+    if (a.id != b.id || a.tex != b.tex || (b.position - a.position).norm() > SNAPSHOT_MAX_JUMP)
+      return b;
+    // rotate along the shortest arc
+    double dangle = fmod(b.angle - a.angle + M_PI, 2 * M_PI);
+    if (dangle < 0)
+      dangle += 2 * M_PI;
+    SpriteState s = b;
+    s.position = a.position + alpha * (b.position - a.position);
+    s.angle = a.angle + alpha * (dangle - M_PI);
+    s.scale = a.scale + alpha * (b.scale - a.scale);
+    return s;
+  }
+
+  //! add the interpolated sprites of \arg layer to \arg batch
+  static void add(SpriteBatch & batch, const std::vector<SpriteState> & prev_layer,
+                  const std::vector<SpriteState> & layer, double alpha) {
+    for (unsigned int i = 0; i < layer.size(); ++i) {
+      SpriteState s = interpolate(prev_layer, layer, i, alpha);
+      batch.add(*s.tex, s.position, s.scale, s.angle);
+    }
+  }
+
+#if DEBUG
+  //! add the overlay of \arg e then of its children
+  static void add(std::vector<DebugState> & layer, const Entity & e) {
+    DebugState d;
+    d.position = e.get_position();
+    d.speed = e.get_speed();
+    d.accel = e.get_accel();
+    e.rough_bbox(d.rough_bbox);
+    std::copy(e.get_tight_bbox(), e.get_tight_bbox() + 4, d.tight_bbox);
+    d.collision_pt = e.get_collision_pt();
+    layer.push_back(d);
+    for (unsigned int i = 0; i < e.get_nchildren(); ++i)
+      add(layer, e.get_child(i));
+  }
+
+  //! draw the overlays of \arg layer, as they were at the tick, without interpolation
+  static bool render(SDL_Renderer* renderer, const std::vector<DebugState> & layer) {
+    bool ok = true;
+    for (unsigned int i = 0; i < layer.size(); ++i) {
+      const DebugState & d = layer[i];
+      ok = render_arrow(renderer, d.position, d.position + d.speed, 255, 0, 0, 255) && ok;
+      ok = render_arrow(renderer, d.position, d.position + d.accel, 0, 255, 0, 255) && ok;
+      ok = render_rect(renderer, d.rough_bbox, 200, 0, 0, 255) && ok;
+      std::vector<Point2d> tight_bbox(d.tight_bbox, d.tight_bbox + 4);
+      ok = render_polygon(renderer, tight_bbox, 0, 255, 0, 255) && ok;
+      if (d.collision_pt.x > 0)
+        render_point(renderer, d.collision_pt, 5, 255, 255, 0);
+    } // end loop i
+    return ok;
+  }
+#endif // DEBUG
+
+  unsigned long tick; //!< of the simulation clock
+  double publish_time; //!< monotonic_seconds() when published
+  std::vector<SpriteState> candies, cars, fishes, bubbles;
+  std::vector<PlayerState> players;
+  int status; //!< the GameStatus
+  int hud_time; //!< the seconds displayed, < 0 if none
+#if DEBUG
+  std::vector<DebugState> debug; //!< the candies, cars and fishes
+#endif // DEBUG
+}; // end struct WorldSnapshot
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*! A triple buffer between one writer, the simulation, and one reader,
+  the rendering, plus a fourth snapshot kept by the reader,
+  the one before the latest, to interpolate between them.
+  The writer fills back(), then publish() exchanges it with the middle one.
+  The reader's acquire() takes the middle one if it is newer.
+  Neither waits for the other: the lock only protects the exchange
+  of the indices, and no snapshot is ever copied.
+*/
+class SnapshotBuffer {
+public:
+  SnapshotBuffer() : _back(0), _middle(1), _previous(2), _latest(3),
+    _fresh(false), _lock(0) {}
+
+  //! the snapshot being written, owned by the writer until publish()
+  inline WorldSnapshot & back() { return _snapshots[_back]; }
+
+  //! make back() the latest snapshot, and get a new back()
+  void publish() {
+    _snapshots[_back].publish_time = monotonic_seconds();
+    SDL_AtomicLock(&_lock);
+    std::swap(_back, _middle);
+    _fresh = true;
+    SDL_AtomicUnlock(&_lock);
+  }
+
+  //! \return true if a new snapshot was published since the last call
+  bool acquire() {
+    SDL_AtomicLock(&_lock);
+    bool fresh = _fresh;
+    if (fresh) // the oldest snapshot goes back to the writer
+      std::swap(_middle, _previous);
+    _fresh = false;
+    SDL_AtomicUnlock(&_lock);
+    if (fresh)
+      std::swap(_previous, _latest);
+    return fresh;
+  }
+
+  //! the snapshots owned by the reader, valid until the next acquire()
+  inline const WorldSnapshot & latest() const { return _snapshots[_latest]; }
+  inline const WorldSnapshot & previous() const { return _snapshots[_previous]; }
+
+private:
+  WorldSnapshot _snapshots[4];
+  unsigned int _back, _middle, _previous, _latest; // indices in _snapshots
+  bool _fresh; //!< true if _middle was published after the last acquire()
+  SDL_SpinLock _lock;
+}; // end class SnapshotBuffer
+
+#endif // WORLD_SNAPSHOT_H